@@ -22,138 +22,565 @@
 
 #include "dep.h"
 
+#define GETDEP(deps, i) ASGETPTR(dep, &(deps)->deps, i)
+
 void deps_init(struct deps *deps, struct strings *strings) {
-	array_init(&deps->names, 0);
-	array_init(&deps->epochs, 0);
-	array_init(&deps->vers, 0);
-	array_init(&deps->rels, 0);
-	array_init(&deps->flags, 0);
-	hashtable_init(&deps->hashtable);
+	deps_init_arena(deps, strings, NULL);
+}
+
+void deps_init_arena(struct deps *deps, struct strings *strings, struct arena *arena) {
+	array_init_arena(&deps->deps, sizeof (struct dep), arena);
+	array_init_arena(&deps->evr_offsets, 0, arena);
+	array_init_arena(&deps->evr_sizes, 0, arena);
+	array_init_arena(&deps->evr_data, 1, arena);
+	array_init_arena(&deps->prov_first, 0, arena);
+	array_init_arena(&deps->prov_deps, 0, arena);
+	hashtable_init_arena(&deps->hashtable, arena);
+	deps->vercache = calloc(1, sizeof (struct vercache));
+	deps->vercache->entries = calloc(VERCACHE_SIZE, sizeof (struct vercache_entry));
 	deps->strings = strings;
 }
 
 void deps_clean(struct deps *deps) {
-	array_clean(&deps->names);
-	array_clean(&deps->epochs);
-	array_clean(&deps->vers);
-	array_clean(&deps->rels);
-	array_clean(&deps->flags);
+	array_clean(&deps->deps);
+	array_clean(&deps->evr_offsets);
+	array_clean(&deps->evr_sizes);
+	array_clean(&deps->evr_data);
+	array_clean(&deps->prov_first);
+	array_clean(&deps->prov_deps);
 	hashtable_clean(&deps->hashtable);
+	free(deps->vercache->entries);
+	free(deps->vercache);
+}
+
+void deps_reserve(struct deps *deps, uint count) {
+	array_reserve(&deps->deps, count, 0);
+	hashtable_reserve(&deps->hashtable, count);
+}
+
+/*
+ * Versions are encoded as sequences of tokens which compare with memcmp()
+ * in the same order as with rpmvercmp(). Separators are dropped, alpha
+ * segments are terminated by zero and numeric segments are stored without
+ * leading zeros after their length, so longer numbers compare as larger.
+ */
+#define EVR_TILDE	0x01
+#define EVR_END		0x02
+#define EVR_CARET	0x03
+#define EVR_ALPHA	0x04
+#define EVR_NUMERIC	0x05
+
+#define EVR_LONG	0xff
+
+static inline int evr_isdigit(char c) {
+	return c >= '0' && c <= '9';
 }
 
-static char *parse_epoch(char *s, uint *epoch) {
-	char *c = strchr(s, ':');
+static inline int evr_isalpha(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static uint encode_evr(unsigned char *e, const char *s) {
+	const char *t;
+	uint i = 0, len;
+
+	while (1) {
+		while (*s && !evr_isdigit(*s) && !evr_isalpha(*s) && *s != '~' && *s != '^')
+			s++;
 
-	if (c != NULL) {
-		*c = '\0';
-		*epoch = atoi(s);
-		return c + 1;
+		if (!*s)
+			break;
+		else if (*s == '~' || *s == '^') {
+			e[i++] = *s++ == '~' ? EVR_TILDE : EVR_CARET;
+		} else if (evr_isdigit(*s)) {
+			while (*s == '0')
+				s++;
+			for (t = s; evr_isdigit(*t); t++)
+				;
+			len = t - s;
+			e[i++] = EVR_NUMERIC;
+			if (len < EVR_LONG) {
+				e[i++] = len;
+			} else {
+				e[i++] = EVR_LONG;
+				e[i++] = len >> 24;
+				e[i++] = len >> 16;
+				e[i++] = len >> 8;
+				e[i++] = len;
+			}
+			memcpy(e + i, s, len);
+			i += len;
+			s = t;
+		} else {
+			e[i++] = EVR_ALPHA;
+			while (evr_isalpha(*s))
+				e[i++] = *s++;
+			e[i++] = '\0';
+		}
 	}
-	return s;
+	e[i++] = EVR_END;
+
+	return i;
 }
 
-static char *parse_ver(char *s) {
-	char *c = strchr(s, '-');
+static void add_evr(struct deps *deps, uint str) {
+	const char *s;
+	uint len, start;
 
-	if (c != NULL) {
-		*c = '\0';
-		return c + 1;
+	if (str < array_get_size(&deps->evr_sizes) && array_get(&deps->evr_sizes, str))
+		return;
+
+	/* empty strings are not encoded, they don't compare */
+	len = strings_get_len(deps->strings, str);
+	if (!len)
+		return;
+
+	s = strings_get(deps->strings, str);
+	start = array_get_size(&deps->evr_data);
+
+	/* each character needs at most three bytes, plus the end token */
+	array_get_wptr(&deps->evr_data, start + len * 3);
+	len = encode_evr(array_get_wptr(&deps->evr_data, start), s);
+	array_set_size(&deps->evr_data, start + len);
+
+	array_set(&deps->evr_offsets, str, start);
+	array_set(&deps->evr_sizes, str, len);
+}
+
+/* look up the result of comparison of two strings, smaller id first */
+static struct vercache_entry *vercache_find(struct vercache *cache, uint s1, uint s2, int *found) {
+	struct vercache_entry *e, *empty = NULL;
+	uint i, h = (s1 * 0x9e3779b1) ^ (s2 * 0x85ebca6b);
+
+	h ^= h >> 15;
+
+	for (i = 0; i < VERCACHE_PROBES; i++) {
+		e = cache->entries + ((h + i) & (VERCACHE_SIZE - 1));
+		if (e->s1 == s1 && e->s2 == s2) {
+			*found = 1;
+			return e;
+		}
+		/* entries with equal ids are never stored, so they are free */
+		if (e->s1 == e->s2 && empty == NULL)
+			empty = e;
 	}
-	return NULL;
+
+	*found = 0;
+
+	/* when all probed entries are used, replace the first one */
+	return empty != NULL ? empty : cache->entries + (h & (VERCACHE_SIZE - 1));
 }
 
-static uint dephash(uint name) {
-	return 13 * name << 8 ^ name;
+static int sign(int x) {
+	return x > 0 ? 1 : (x < 0 ? -1 : 0);
 }
 
-uint deps_add(struct deps *deps, const char *name, int flags, const char *vers) {
-	uint epoch = 0;
-	char *v = NULL, *r = NULL, buf[1000];
-	
-	if (vers && *vers) {
-		buf[sizeof (buf) - 1] = '\0';
-		strncpy(buf, vers, sizeof (buf) - 1);
-		v = parse_epoch(buf, &epoch);
-		r = parse_ver(v);
+static int encoded_evrcmp(const struct deps *deps, uint s1, uint l1, uint s2, uint l2) {
+	int d;
+
+	d = memcmp(array_get_ptr(&deps->evr_data, array_get(&deps->evr_offsets, s1)),
+			array_get_ptr(&deps->evr_data, array_get(&deps->evr_offsets, s2)),
+			MIN(l1, l2));
+	if (!d)
+		d = l1 - l2;
+
+	return sign(d);
+}
+
+static int evrcmp(const struct deps *deps, uint s1, uint s2) {
+	struct vercache *cache = deps->vercache;
+	struct vercache_entry *e;
+	uint l1, l2;
+	int d, found, swap;
+
+	if (s1 == s2)
+		return 0;
+
+	l1 = s1 < array_get_size(&deps->evr_sizes) ? array_get(&deps->evr_sizes, s1) : 0;
+	l2 = s2 < array_get_size(&deps->evr_sizes) ? array_get(&deps->evr_sizes, s2) : 0;
+	if (!l1 || !l2)
+		return 0;
+
+	swap = s1 > s2;
+	e = swap ? vercache_find(cache, s2, s1, &found) : vercache_find(cache, s1, s2, &found);
+
+	if (found) {
+		cache->hits++;
+		d = swap ? -e->result : e->result;
+	} else {
+		cache->misses++;
+		d = encoded_evrcmp(deps, s1, l1, s2, l2);
+		e->s1 = MIN(s1, s2);
+		e->s2 = MAX(s1, s2);
+		e->result = swap ? -d : d;
 	}
-	return deps_add_evr(deps, name, flags, epoch, v, r);
+
+	return d;
 }
-	
-uint deps_add_evr(struct deps *deps, const char *name, int flags, uint epoch,
-		const char *version, const char *release) {
-	uint i, iter = 0, hash, size = array_get_size(&deps->names), ver, rel, nam;
 
-	nam = strings_add(deps->strings, name);
-	ver = strings_add(deps->strings, version != NULL ? version : "");
-	rel = strings_add(deps->strings, release != NULL ? release : "");
+/* versions and releases with cases where the encoding can go wrong */
+static const char *check_evrs[] = {
+	"1", "01", "001", "1.0", "1.00", "1.01", "1.001", "1.1", "1.10", "1.010",
+	"10", "010", "0", "00", "1.0a", "1.0.a", "1a", "1b", "a", "A", "Z", "b",
+	"1~", "1~rc1", "1~rc2", "1~~", "1~rc1~1", "1.0~rc1", "1.0~", "~1", "~",
+	"1^", "1^git1", "1^git2", "1^~", "1~^", "1.0^", "1.0^1", "1.0^a", "^1",
+	"1^1~1", "1.0.1", "1_0", "1+0", "1..0", "1.0.", ".1", "1a1", "1a.1",
+	"2.0", "2.0.0", "20", "12345678901234567890", "12345678901234567891",
+	"99999999999999999999999", "fc30", "fc9", "el8", "el8_1", "el8.1",
+	"1.el8", "1.el8_10", "1.el8_9", "1.fc30", "1.fc9"
+};
+
+struct check_evr {
+	const char *s;
+	uint id;
+};
+
+static int compare_check_evrs(const void *p1, const void *p2) {
+	return rpmvercmp(((const struct check_evr *)p1)->s, ((const struct check_evr *)p2)->s);
+}
+
+/*
+ * Sort the encoded strings with rpmvercmp() and compare the neighbours,
+ * or all pairs, with the encoded comparison. The cache is not used.
+ */
+static uint check_encoded(const struct deps *deps, int all_pairs, FILE *f) {
+	struct check_evr *evrs;
+	uint i, j, n, l1, l2, size, mismatches = 0;
+	int r, d;
+
+	size = array_get_size(&deps->evr_sizes);
+	evrs = malloc(size * sizeof (struct check_evr));
 
-	if (hashtable_resize(&deps->hashtable)) {
-		for (i = 0; i < size; i++) {
-			hash = dephash(array_get(&deps->names, i));
-			hashtable_add(&deps->hashtable, i, hash);
+	for (i = n = 0; i < size; i++) {
+		if (!array_get(&deps->evr_sizes, i))
+			continue;
+		evrs[n].s = strings_get(deps->strings, i);
+		evrs[n++].id = i;
+	}
+
+	qsort(evrs, n, sizeof (struct check_evr), compare_check_evrs);
+
+	for (i = 0; i < n; i++) {
+		for (j = i + 1; j < n && (all_pairs || j == i + 1); j++) {
+			l1 = array_get(&deps->evr_sizes, evrs[i].id);
+			l2 = array_get(&deps->evr_sizes, evrs[j].id);
+			d = encoded_evrcmp(deps, evrs[i].id, l1, evrs[j].id, l2);
+			r = sign(rpmvercmp(evrs[i].s, evrs[j].s));
+			if (d == r)
+				continue;
+			fprintf(f, "%s %s: %d, rpmvercmp %d\n", evrs[i].s, evrs[j].s, d, r);
+			mismatches++;
 		}
 	}
 
-	hash = dephash(nam);
+	free(evrs);
+	return mismatches;
+}
+
+/*
+ * Compare the order of all encoded versions and releases and a built-in
+ * list of special cases with rpmvercmp(), return number of mismatches.
+ */
+uint deps_check_evrcmp(const struct deps *deps, FILE *f) {
+	struct strings strings;
+	struct deps check;
+	uint i, mismatches;
+
+	mismatches = check_encoded(deps, 0, f);
+
+	strings_init(&strings);
+	deps_init(&check, &strings);
+	for (i = 0; i < sizeof (check_evrs) / sizeof (check_evrs[0]); i++)
+		add_evr(&check, strings_add(&strings, check_evrs[i]));
+	mismatches += check_encoded(&check, 1, f);
+	deps_clean(&check);
+	strings_clean(&strings);
+
+	return mismatches;
+}
+
+static uint dephash(const struct dep *dep) {
+	return (((dep->name * 31 + dep->epoch) * 31 + dep->ver) * 31 + dep->rel) * 31 + dep->flags;
+}
+
+static uint add_dep(struct deps *deps, uint nam, int flags, uint epoch, uint ver, uint rel) {
+	uint i, iter = 0, hash;
+	struct dep dep;
+
+	add_evr(deps, ver);
+	add_evr(deps, rel);
+
+	hashtable_resize(&deps->hashtable);
+
+	memset(&dep, 0, sizeof (dep));
+	dep.name = nam;
+	dep.epoch = epoch;
+	dep.ver = ver;
+	dep.rel = rel;
+	dep.flags = flags;
+	hash = dephash(&dep);
 
 	while ((i = hashtable_find(&deps->hashtable, hash, &iter)) != -1)
-		if (array_get(&deps->names, i) == nam &&
-				array_get(&deps->epochs, i) == epoch &&
-				array_get(&deps->vers, i) == ver &&
-				array_get(&deps->rels, i) == rel &&
-				array_get(&deps->flags, i) == flags)
+		if (!memcmp(GETDEP(deps, i), &dep, sizeof (dep)))
 			break;
 	if (i != -1)
 		/* already stored */
 		return i;
 
-	i = size;
-	array_set(&deps->names, i, nam);
-	array_set(&deps->epochs, i, epoch);
-	array_set(&deps->vers, i, ver);
-	array_set(&deps->rels, i, rel);
-	array_set(&deps->flags, i, flags);
+	i = array_get_size(&deps->deps);
+	*ASGETWPTR(dep, &deps->deps, i) = dep;
 	hashtable_add_dir(&deps->hashtable, i, hash, iter);
 
 	return i;
 }
 
-uint deps_find(const struct deps *deps, uint dep, uint *iter) {
-	uint i, hash = dephash(array_get(&deps->names, dep));
+uint deps_add(struct deps *deps, const char *name, int flags, const char *vers) {
+	const char *c, *v = "", *colon = NULL, *dash = NULL;
+	uint epoch = 0, vlen = 0, rlen = 0;
 
-	while ((i = hashtable_find(&deps->hashtable, hash, iter)) != -1)
-		if (dep == i || deps_match(deps, dep, i))
-			break;
-	return i;
+	if (vers && *vers) {
+		/* epoch ends at the first colon, release starts after the next dash */
+		for (c = vers; *c; c++) {
+			if (*c == ':' && !colon) {
+				colon = c;
+				dash = NULL;
+			} else if (*c == '-' && !dash)
+				dash = c;
+		}
+
+		if (colon) {
+			epoch = atoi(vers);
+			v = colon + 1;
+		} else
+			v = vers;
+
+		if (dash) {
+			vlen = dash - v;
+			rlen = c - dash - 1;
+		} else
+			vlen = c - v;
+	}
+
+	return add_dep(deps, strings_add(deps->strings, name), flags, epoch,
+			strings_add_len(deps->strings, v, vlen),
+			strings_add_len(deps->strings, dash ? dash + 1 : "", rlen));
+}
+	
+uint deps_add_evr(struct deps *deps, const char *name, int flags, uint epoch,
+		const char *version, const char *release) {
+	return add_dep(deps, strings_add(deps->strings, name), flags, epoch,
+			strings_add(deps->strings, version != NULL ? version : ""),
+			strings_add(deps->strings, release != NULL ? release : ""));
+}
+
+/* add dep without version, name is id of already stored string */
+uint deps_add_name(struct deps *deps, uint name) {
+	uint empty = strings_add_len(deps->strings, "", 0);
+
+	return add_dep(deps, name, 0, 0, empty, empty);
+}
+
+uint deps_get_size(const struct deps *deps) {
+	return array_get_size(&deps->deps);
+}
+
+uint deps_get_name(const struct deps *deps, uint dep) {
+	return GETDEP(deps, dep)->name;
+}
+
+/* compare epoch, version and release, empty strings match anything */
+static int deps_cmp(const struct deps *deps, uint x, uint y) {
+	const struct dep *d1 = GETDEP(deps, x), *d2 = GETDEP(deps, y);
+	int d;
+
+	d = d1->epoch - d2->epoch;
+	if (!d)
+		d = evrcmp(deps, d1->ver, d2->ver);
+	if (!d)
+		d = evrcmp(deps, d1->rel, d2->rel);
+	return d;
+}
+
+/*
+ * Provides of each name are split in three classes. Provides with only
+ * the EQUAL flag and a version are sorted by EVR, separately with and
+ * without release, so the ones matching a versioned require form
+ * a continuous range. The rest is matched one by one.
+ */
+#define PROV_OTHER	0
+#define PROV_EVR	1
+#define PROV_EV		2
+#define PROV_CLASSES	3
+
+static int prov_class(const struct deps *deps, uint dep) {
+	if (GETDEP(deps, dep)->flags != RPMSENSE_EQUAL ||
+			!strings_get_len(deps->strings, GETDEP(deps, dep)->ver))
+		return PROV_OTHER;
+	if (!strings_get_len(deps->strings, GETDEP(deps, dep)->rel))
+		return PROV_EV;
+	return PROV_EVR;
+}
+
+/* the records carry the deps for the comparison, there is no global state */
+struct sort_prov {
+	const struct deps *deps;
+	uint dep;
+};
+
+static int compare_provs(const void *p1, const void *p2) {
+	const struct sort_prov *s1 = p1, *s2 = p2;
+
+	return deps_cmp(s1->deps, s1->dep, s2->dep);
+}
+
+/* not thread safe, the comparisons of versions fill the cache in deps */
+void deps_index_provs(struct deps *deps, const struct sets *provides) {
+	struct array pos;
+	struct sort_prov *provs;
+	uint i, j, n, s, k, keys;
+
+	array_clean(&deps->prov_first);
+	array_clean(&deps->prov_deps);
+
+	n = array_get_size(&deps->deps);
+
+	for (i = keys = 0; i < n; i++)
+		if (sets_find_size(provides, i))
+			keys = MAX(keys, (GETDEP(deps, i)->name + 1) * PROV_CLASSES);
+
+	array_init(&pos, 0);
+	array_set_size(&pos, keys + 1);
+
+	for (i = 0; i < n; i++)
+		if (sets_find_size(provides, i))
+			array_inc(&pos, GETDEP(deps, i)->name * PROV_CLASSES +
+					prov_class(deps, i) + 1, 1);
+
+	for (k = s = 0; k <= keys; k++) {
+		s += array_get(&pos, k);
+		array_set(&pos, k, s);
+	}
+
+	array_clone(&deps->prov_first, &pos);
+	array_reserve(&deps->prov_deps, s, n);
+	array_set_size(&deps->prov_deps, s);
+
+	for (i = 0; i < n; i++) {
+		if (!sets_find_size(provides, i))
+			continue;
+		k = GETDEP(deps, i)->name * PROV_CLASSES + prov_class(deps, i);
+		array_set(&deps->prov_deps, array_get(&pos, k), i);
+		array_inc(&pos, k, 1);
+	}
+	array_clean(&pos);
+
+	/* sort the versioned provides */
+	provs = malloc(s * sizeof (struct sort_prov));
+	for (k = 0; k < keys; k++) {
+		if (k % PROV_CLASSES == PROV_OTHER)
+			continue;
+		i = array_get(&deps->prov_first, k);
+		s = array_get(&deps->prov_first, k + 1) - i;
+		if (s < 2)
+			continue;
+		for (j = 0; j < s; j++) {
+			provs[j].deps = deps;
+			provs[j].dep = array_get(&deps->prov_deps, i + j);
+		}
+		qsort(provs, s, sizeof (struct sort_prov), compare_provs);
+		for (j = 0; j < s; j++)
+			array_set(&deps->prov_deps, i + j, provs[j].dep);
+	}
+	free(provs);
+}
+
+/* first provide in the sorted range which can match the require */
+static uint prov_range_start(const struct deps *deps, uint req, uint left, uint right) {
+	uint center, f = GETDEP(deps, req)->flags;
+
+	if (f & RPMSENSE_LESS)
+		return left;
+
+	while (left < right) {
+		center = (left + right) / 2;
+		if (deps_cmp(deps, req, array_get(&deps->prov_deps, center)) > 0 ||
+				(!(f & RPMSENSE_EQUAL) && !deps_cmp(deps, req,
+					array_get(&deps->prov_deps, center))))
+			left = center + 1;
+		else
+			right = center;
+	}
+
+	return left;
+}
+
+/* find provides matching the require, deps_index_provs() has to be called first */
+uint deps_find_prov(const struct deps *deps, uint req, uint *iter) {
+	uint i, f, pos, name, prov, segs[PROV_CLASSES + 1];
+	int range;
+
+	name = GETDEP(deps, req)->name;
+	if ((name + 1) * PROV_CLASSES >= array_get_size(&deps->prov_first))
+		return -1;
+
+	for (i = 0; i <= PROV_CLASSES; i++)
+		segs[i] = array_get(&deps->prov_first, name * PROV_CLASSES + i);
+
+	/* versioned requires with a continuous range of matching EVRs */
+	f = GETDEP(deps, req)->flags;
+	range = f && !(f & ~(RPMSENSE_LESS | RPMSENSE_GREATER | RPMSENSE_EQUAL)) &&
+		f != (RPMSENSE_LESS | RPMSENSE_GREATER) &&
+		strings_get_len(deps->strings, GETDEP(deps, req)->ver);
+
+	pos = MAX(*iter, segs[0]);
+
+	for (i = 0; i < PROV_CLASSES; i++) {
+		if (pos >= segs[i + 1])
+			continue;
+
+		if (i != PROV_OTHER && range) {
+			/* find the start of the range, then continue while matching */
+			if (pos == segs[i])
+				pos = prov_range_start(deps, req, segs[i], segs[i + 1]);
+			if (pos < segs[i + 1]) {
+				prov = array_get(&deps->prov_deps, pos);
+				if (deps_match(deps, req, prov)) {
+					*iter = pos + 1;
+					return prov;
+				}
+			}
+			pos = segs[i + 1];
+			continue;
+		}
+
+		for (; pos < segs[i + 1]; pos++) {
+			prov = array_get(&deps->prov_deps, pos);
+			if (prov == req || deps_match(deps, req, prov)) {
+				*iter = pos + 1;
+				return prov;
+			}
+		}
+	}
+
+	*iter = pos;
+	return -1;
 }
 
 int deps_match(const struct deps *deps, uint x, uint y) {
+	const struct dep *d1 = GETDEP(deps, x), *d2 = GETDEP(deps, y);
 	uint f1, f2;
-	const char *s1, *s2;
 	int d;
 
-	if (array_get(&deps->names, x) != array_get(&deps->names, y))
+	if (d1->name != d2->name)
 	       return 0;
 
-	f1 = array_get(&deps->flags, x);
-        f2 = array_get(&deps->flags, y);
+	f1 = d1->flags;
+	f2 = d2->flags;
 
 	if (!f1 || !f2)
 		return 1;
 
-	d = array_get(&deps->epochs, x) - array_get(&deps->epochs, y);
-	if (!d) {
-		s1 = strings_get(deps->strings, array_get(&deps->vers, x)); 
-		s2 = strings_get(deps->strings, array_get(&deps->vers, y)); 
-		if (*s1 && *s2)
-			d = rpmvercmp(s1, s2);
-	}
-	if (!d) {
-		s1 = strings_get(deps->strings, array_get(&deps->rels, x)); 
-		s2 = strings_get(deps->strings, array_get(&deps->rels, y)); 
-		if (*s1 && *s2)
-			d = rpmvercmp(s1, s2);
-	}
+	d = deps_cmp(deps, x, y);
 	if ((!d && f1 & f2) ||
 			(d > 0 && (f1 & RPMSENSE_LESS || f2 & RPMSENSE_GREATER)) ||
 			(d < 0 && (f1 & RPMSENSE_GREATER || f2 & RPMSENSE_LESS)))
@@ -162,14 +589,15 @@ int deps_match(const struct deps *deps, uint x, uint y) {
 }
 
 int deps_print(const struct deps *deps, uint dep, char *str, size_t size) {
+	const struct dep *d = GETDEP(deps, dep);
 	const char *n, *v, *r;
 	uint f;
 	int s, l;
 
-	n = strings_get(deps->strings, array_get(&deps->names, dep));
-	v = strings_get(deps->strings, array_get(&deps->vers, dep));
-	r = strings_get(deps->strings, array_get(&deps->rels, dep));
-	f = array_get(&deps->flags, dep);
+	n = strings_get(deps->strings, d->name);
+	v = strings_get(deps->strings, d->ver);
+	r = strings_get(deps->strings, d->rel);
+	f = d->flags;
 
 	s = snprintf(str, size, "%s", n);
 	if (s < 0 || s >= size)
@@ -18,25 +18,65 @@
 #ifndef _DEP_H_
 #define _DEP_H_
 
+#include <stdio.h>
+
 #include "misc.h"
 
+#define VERCACHE_SIZE (1 << 14)
+#define VERCACHE_PROBES 4
+
+struct vercache_entry {
+	uint s1;
+	uint s2;
+	int result;
+};
+
+/* bounded cache of version comparisons */
+struct vercache {
+	struct vercache_entry *entries;
+	uint hits;
+	uint misses;
+};
+
+/* all fields of dep in one record, compared as a whole when adding */
+struct dep {
+	uint name;
+	uint epoch;
+	uint ver;
+	uint rel;
+	uint flags;
+};
+
 struct deps {
-	struct array names;
-	struct array epochs;
-	struct array vers;
-	struct array rels;
-	struct array flags;
+	struct array deps;
 	struct hashtable hashtable;
 	struct strings *strings;
+
+	/* version and release strings split into comparable segments */
+	struct array evr_offsets;
+	struct array evr_sizes;
+	struct array evr_data;
+	struct vercache *vercache;
+
+	/* provides grouped by name and sorted by EVR */
+	struct array prov_first;
+	struct array prov_deps;
 };
 
 void deps_init(struct deps *deps, struct strings *strings);
+void deps_init_arena(struct deps *deps, struct strings *strings, struct arena *arena);
 void deps_clean(struct deps *deps);
+void deps_reserve(struct deps *deps, uint count);
 uint deps_add(struct deps *deps, const char *name, int flags, const char *ver);
 uint deps_add_evr(struct deps *deps, const char *name, int flags,
 		uint epoch, const char *version, const char *release);
-uint deps_find(const struct deps *deps, uint dep, uint *iter);
+uint deps_add_name(struct deps *deps, uint name);
+uint deps_get_size(const struct deps *deps);
+uint deps_get_name(const struct deps *deps, uint dep);
+void deps_index_provs(struct deps *deps, const struct sets *provides);
+uint deps_find_prov(const struct deps *deps, uint req, uint *iter);
 int deps_match(const struct deps *deps, uint x, uint y);
 int deps_print(const struct deps *deps, uint dep, char *str, size_t size);
+uint deps_check_evrcmp(const struct deps *deps, FILE *f);
 
 #endif
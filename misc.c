@@ -18,6 +18,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "misc.h"
 
@@ -25,8 +32,229 @@
 #define ARRAYS_FIXED
 #endif
 
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	size_t last;
+};
+
+#define ARENA_ALIGN(s) (((s) + 15) & ~(size_t)15)
+#define ARENA_HEADER ARENA_ALIGN(sizeof (struct arena_chunk))
+#define ARENA_CHUNK_MIN (1 << 20)
+#define ARENA_CHUNK_MAX (64 << 20)
+#define ARENA_LARGE_SIZE (64 << 10)
+#define ARENA_LARGE(s) (ARENA_ALIGN(s) >= ARENA_LARGE_SIZE)
+
+static inline char *chunk_data(struct arena_chunk *c) {
+	return (char *)c + ARENA_HEADER;
+}
+
+void arena_init(struct arena *arena) {
+	memset(arena, 0, sizeof (struct arena));
+	arena->chunk_size = ARENA_CHUNK_MIN;
+}
+
+static void free_chunks(struct arena_chunk *c) {
+	struct arena_chunk *next;
+
+	for (; c != NULL; c = next) {
+		next = c->next;
+		munmap(c, c->size + ARENA_HEADER);
+	}
+}
+
+void arena_clean(struct arena *arena) {
+	free_chunks(arena->chunks);
+	free_chunks(arena->free);
+	free_chunks(arena->large);
+	memset(arena, 0, sizeof (struct arena));
+}
+
+/* drop all allocations, but keep the chunks for reuse */
+void arena_reset(struct arena *arena) {
+	struct arena_chunk *c, *next;
+
+	for (c = arena->chunks; c != NULL; c = next) {
+		next = c->next;
+		c->next = arena->free;
+		arena->free = c;
+	}
+	arena->chunks = NULL;
+	free_chunks(arena->large);
+	arena->large = NULL;
+	memset(arena->free_blocks, 0, sizeof (arena->free_blocks));
+}
+
+static struct arena_chunk *arena_new_chunk(struct arena *arena, size_t size) {
+	struct arena_chunk *c, **p;
+	long page = sysconf(_SC_PAGESIZE);
+
+	for (p = &arena->free; *p != NULL; p = &(*p)->next)
+		if ((*p)->size >= size)
+			break;
+
+	if (*p != NULL) {
+		c = *p;
+		*p = c->next;
+	} else {
+		/* chunks get larger as the arena grows */
+		size = (MAX(size, arena->chunk_size) + ARENA_HEADER + page - 1) / page * page;
+		c = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (c == MAP_FAILED)
+			abort();
+		c->size = size - ARENA_HEADER;
+		arena->chunk_size = MIN(arena->chunk_size * 2, ARENA_CHUNK_MAX);
+	}
+
+	c->used = c->last = 0;
+	c->next = arena->chunks;
+	arena->chunks = c;
+
+	return c;
+}
+
+struct arena_block {
+	struct arena_block *next;
+};
+
+/* large blocks are unmapped when they are freed */
+static void *large_alloc(struct arena *arena, size_t size) {
+	struct arena_chunk *c;
+	long page = sysconf(_SC_PAGESIZE);
+
+	size = (size + ARENA_HEADER + page - 1) / page * page;
+	c = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (c == MAP_FAILED)
+		abort();
+	c->size = size - ARENA_HEADER;
+	c->used = c->last = 0;
+	c->next = arena->large;
+	arena->large = c;
+
+	return chunk_data(c);
+}
+
+static void large_free(struct arena *arena, void *ptr) {
+	struct arena_chunk *c, **p;
+
+	c = (struct arena_chunk *)((char *)ptr - ARENA_HEADER);
+	for (p = &arena->large; *p != c; p = &(*p)->next)
+		assert(*p != NULL);
+	*p = c->next;
+	munmap(c, c->size + ARENA_HEADER);
+}
+
+static inline uint size_class(size_t size) {
+	return sizeof (long) * 8 - 1 - __builtin_clzl(size);
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+	struct arena_chunk *c = arena->chunks;
+	struct arena_block *b;
+	uint class;
+
+	if (ARENA_LARGE(size))
+		return large_alloc(arena, size);
+
+	size = ARENA_ALIGN(size);
+
+	/* reuse a freed block from the smallest class which surely fits */
+	if (size) {
+		class = size_class(size);
+		if (size > (size_t)1 << class)
+			class++;
+		if (class < ARENA_CLASSES && (b = arena->free_blocks[class]) != NULL) {
+			arena->free_blocks[class] = b->next;
+			return b;
+		}
+	}
+
+	if (c == NULL || c->used + size > c->size)
+		c = arena_new_chunk(arena, size);
+
+	c->last = c->used;
+	c->used += size;
+
+	return chunk_data(c) + c->last;
+}
+
+/*
+ * The last allocation is resized in place if there is room in the chunk,
+ * large blocks if there is room in their pages. A block is large if and only
+ * if its size is large.
+ */
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size, size_t size) {
+	struct arena_chunk *c = arena->chunks;
+	void *p;
+
+	if (ptr != NULL && ARENA_LARGE(old_size)) {
+		c = (struct arena_chunk *)((char *)ptr - ARENA_HEADER);
+		if (ARENA_LARGE(size) && size <= c->size)
+			return ptr;
+	} else if (ptr != NULL && (char *)ptr == chunk_data(c) + c->last &&
+			!ARENA_LARGE(size) && c->last + ARENA_ALIGN(size) <= c->size) {
+		c->used = c->last + ARENA_ALIGN(size);
+		return ptr;
+	}
+
+	if (size <= old_size && !ARENA_LARGE(old_size))
+		return ptr;
+
+	p = arena_alloc(arena, size);
+	if (ptr != NULL) {
+		memcpy(p, ptr, MIN(old_size, size));
+		arena_free(arena, ptr, old_size);
+	}
+
+	return p;
+}
+
+/* small blocks are kept for reuse in later allocations */
+void arena_free(struct arena *arena, void *ptr, size_t size) {
+	struct arena_chunk *c = arena->chunks;
+	struct arena_block *b = ptr;
+	uint class;
+
+	if (ptr == NULL || !size)
+		return;
+
+	if (ARENA_LARGE(size)) {
+		large_free(arena, ptr);
+		return;
+	}
+
+	/* the last allocation is returned to the chunk */
+	if ((char *)ptr == chunk_data(c) + c->last) {
+		c->used = c->last;
+		return;
+	}
+
+	class = MIN(size_class(ARENA_ALIGN(size)), ARENA_CLASSES - 1);
+	b->next = arena->free_blocks[class];
+	arena->free_blocks[class] = b;
+}
+
+static void *mem_realloc(struct arena *arena, void *ptr, size_t old_size, size_t size) {
+	if (arena != NULL)
+		return arena_realloc(arena, ptr, old_size, size);
+	return realloc(ptr, size);
+}
+
+static void mem_free(struct arena *arena, void *ptr, size_t size) {
+	if (arena != NULL)
+		arena_free(arena, ptr, size);
+	else
+		free(ptr);
+}
+
 void array_init(struct array *a, unsigned char width) {
+	array_init_arena(a, width, NULL);
+}
+
+void array_init_arena(struct array *a, unsigned char width, struct arena *arena) {
 	memset(a, 0, sizeof (struct array));
+	a->arena = arena;
 	a->width = width;
 	if (width)
 		a->fixed = 1;
@@ -37,8 +265,11 @@ void array_init(struct array *a, unsigned char width) {
 }
 
 void array_clean(struct array *a) {
-	free(a->array);
+	struct arena *arena = a->arena;
+
+	mem_free(arena, a->array, a->width * a->alloced);
 	memset(a, 0, sizeof (struct array));
+	a->arena = arena;
 }
 
 static inline void array_zero_no_check(struct array *a, uint start, uint size) {
@@ -89,25 +320,118 @@ static inline uint array_read(const uint *a, uint i, unsigned char w) {
 #endif
 }
 
-static void array_resize(struct array *a, unsigned char width, uint size) {
-	uint i, alloc = a->alloced;
+#define WIDEN_LOOP(from, to) \
+	for (i = size; i > 0; i--) \
+		((to *)a)[i - 1] = ((const from *)a)[i - 1]
 
-	while (alloc < size)
-		alloc = !alloc ? 16 : alloc * 2;
+/* convert values in place to larger width, going from the end */
+static void array_widen(uint *a, uint size, unsigned char from, unsigned char to) {
+	uint i;
+
+	switch (from << 4 | to) {
+		case sizeof (char) << 4 | sizeof (short):
+			WIDEN_LOOP(unsigned char, unsigned short);
+			break;
+		case sizeof (char) << 4 | sizeof (uint):
+			WIDEN_LOOP(unsigned char, uint);
+			break;
+		case sizeof (short) << 4 | sizeof (uint):
+			WIDEN_LOOP(unsigned short, uint);
+			break;
+		default:
+			assert(!from);
+			memset(a, 0, size * to);
+	}
+}
+
+static void array_realloc(struct array *a, unsigned char width, uint alloc) {
+	assert(alloc >= a->size);
 
-	a->array = realloc(a->array, MAX(width, a->width) * alloc);
+	a->array = mem_realloc(a->arena, a->array, a->width * a->alloced,
+			MAX(width, a->width) * alloc);
 
 	if (width > a->width) {
-		for (i = a->size; i > 0; i--)
-			array_write(a->array, i - 1, width, array_read(a->array, i - 1, a->width));
+		array_widen(a->array, a->size, a->width, width);
 		a->width = width;
 		array_zero_no_check(a, a->size, alloc - a->size);
-	} else
+	} else if (alloc > a->alloced)
 		array_zero_no_check(a, a->alloced, alloc - a->alloced);
 
 	a->alloced = alloc;
 }
 
+static void array_resize(struct array *a, unsigned char width, uint size) {
+	uint alloc = a->alloced;
+
+	while (alloc < size)
+		alloc = !alloc ? 16 : alloc * 2;
+
+	array_realloc(a, width, alloc);
+}
+
+/* largest value that can be stored without changing width */
+static uint array_get_max(const struct array *a) {
+	if (a->width >= sizeof (uint))
+		return -1;
+	return (1U << a->width * 8) - 1;
+}
+
+/* make room for count values not larger than max_value */
+void array_reserve(struct array *a, uint count, uint max_value) {
+	unsigned char width = a->fixed ? a->width : value_width(max_value);
+
+	if (count > a->alloced || width > a->width)
+		array_realloc(a, width, MAX(count, a->alloced));
+}
+
+void array_append(struct array *a, uint value) {
+	array_set(a, a->size, value);
+}
+
+void array_append_n(struct array *a, const uint *values, uint n) {
+	uint i, max, size = a->size;
+
+	assert(!a->fixed);
+
+	for (i = max = 0; i < n; i++)
+		max = MAX(max, values[i]);
+
+	if (size + n > a->alloced || value_width(max) > a->width)
+		array_resize(a, value_width(max), size + n);
+
+	switch (a->width) {
+		case sizeof (uint):
+			memcpy(a->array + size, values, n * sizeof (uint));
+			break;
+		case sizeof (short):
+			for (i = 0; i < n; i++)
+				((unsigned short *)a->array)[size + i] = values[i];
+			break;
+		case sizeof (char):
+			for (i = 0; i < n; i++)
+				((unsigned char *)a->array)[size + i] = values[i];
+			break;
+	}
+
+	a->size = size + n;
+}
+
+/* release memory allocated over the size */
+void array_shrink(struct array *a) {
+	if (a->alloced == a->size)
+		return;
+
+	if (!a->size || !a->width) {
+		mem_free(a->arena, a->array, a->width * a->alloced);
+		a->array = NULL;
+		a->alloced = 0;
+		return;
+	}
+
+	a->array = mem_realloc(a->arena, a->array, a->width * a->alloced, a->width * a->size);
+	a->alloced = a->size;
+}
+
 void array_set(struct array *a, uint index, uint value) {
 	unsigned char width;
 
@@ -154,7 +478,7 @@ inline const void *array_get_ptr(const struct array *a, uint index) {
 
 void array_set_size(struct array *a, uint size) {
 	if (size > a->alloced) {
-		a->array = realloc(a->array, a->width * size);
+		a->array = mem_realloc(a->arena, a->array, a->width * a->alloced, a->width * size);
 		array_zero_no_check(a, a->alloced, size - a->alloced);
 		a->alloced = size;
 	} else if (size < a->size)
@@ -168,6 +492,7 @@ inline uint array_get_size(const struct array *a) {
 }
 
 void array_clone(struct array *dest, const struct array *source) {
+	array_clean(dest);
 	dest->width = source->width;
 	dest->fixed = source->fixed;
 	array_set_size(dest, source->size);
@@ -186,165 +511,344 @@ void array_move(struct array *a, uint dest, uint source, uint size) {
 	memmove((char *)a->array + dest * a->width, (char *)a->array + source * a->width, size * a->width);
 }
 
-uint array_bsearch(const struct array *a, uint start, uint size, uint value) {
-	uint left, right;
+/* ranges up to this length are searched by counting smaller values */
+#define SEARCH_LINEAR 32
+
+#define COUNT_LESS_SCALAR(a, n, value, i, c) \
+	for (; i < n; i++) \
+		c += a[i] < value
+
+#if defined(__AVX2__)
+#define VECTOR_BYTES 32
+#define VECTOR_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define VECTOR_MASK(x) (uint)_mm256_movemask_epi8(x)
+#define VECTOR_TYPE __m256i
+#define VECTOR_XOR _mm256_xor_si256
+#define VECTOR_SET1(bits) _mm256_set1_epi##bits
+#define VECTOR_CMPGT(bits) _mm256_cmpgt_epi##bits
+#elif defined(__SSE2__)
+#define VECTOR_BYTES 16
+#define VECTOR_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define VECTOR_MASK(x) (uint)_mm_movemask_epi8(x)
+#define VECTOR_TYPE __m128i
+#define VECTOR_XOR _mm_xor_si128
+#define VECTOR_SET1(bits) _mm_set1_epi##bits
+#define VECTOR_CMPGT(bits) _mm_cmpgt_epi##bits
+#endif
+
+/*
+ * Kernels returning the first position in the sorted range with value not
+ * smaller than the searched value. Long ranges are narrowed down without
+ * branches, the rest is counted with vector compares of whole blocks. The
+ * compares are signed, so the sign bit is flipped in both operands.
+ */
+#ifdef VECTOR_BYTES
+#define DEFINE_BSEARCH(type, suffix, bits, sign)				\
+static inline uint count_less_##suffix(const type *a, uint n, uint value) {	\
+	VECTOR_TYPE flip = VECTOR_SET1(bits)(sign), v;				\
+	uint i, c, bytes;							\
+										\
+	v = VECTOR_XOR(VECTOR_SET1(bits)(value), flip);				\
+	for (i = bytes = 0; i + VECTOR_BYTES / sizeof (type) <= n;		\
+			i += VECTOR_BYTES / sizeof (type))			\
+		bytes += __builtin_popcount(VECTOR_MASK(VECTOR_CMPGT(bits)(v,	\
+					VECTOR_XOR(VECTOR_LOAD(a + i), flip))));\
+	c = bytes / sizeof (type);						\
+	COUNT_LESS_SCALAR(a, n, value, i, c);					\
+	return c;								\
+}										\
+DEFINE_BSEARCH_COMMON(type, suffix)
+#else
+#define DEFINE_BSEARCH(type, suffix, bits, sign)				\
+static inline uint count_less_##suffix(const type *a, uint n, uint value) {	\
+	uint i = 0, c = 0;							\
+										\
+	COUNT_LESS_SCALAR(a, n, value, i, c);					\
+	return c;								\
+}										\
+DEFINE_BSEARCH_COMMON(type, suffix)
+#endif
 
-	left = start;
-	right = start + size;
+#define DEFINE_BSEARCH_COMMON(type, suffix)					\
+uint array_bsearch_##suffix(const type *a, uint left, uint right, uint value) {	\
+	const type *base = a + left;						\
+	uint half, n = right - left;						\
+										\
+	if (value > (type)-1)							\
+		return right;							\
+										\
+	while (n > SEARCH_LINEAR) {						\
+		half = n / 2;							\
+		base = base[half] < value ? base + half : base;			\
+		n -= half;							\
+	}									\
+										\
+	return base - a + count_less_##suffix(base, n, value);			\
+}
 
-	while (left < right) {
-		uint center, v;
-		
-		center = (left + right) / 2;
-		v = array_get(a, center);
+DEFINE_BSEARCH(unsigned char, u8, 8, (char)0x80)
+DEFINE_BSEARCH(unsigned short, u16, 16, (short)0x8000)
+DEFINE_BSEARCH(uint, u32, 32, (int)0x80000000)
 
-		if (v == value)
-			return center;
-		else if (v > value)
-			right = center;
-		else
-			left = center + 1;
+uint array_bsearch(const struct array *a, uint start, uint size, uint value) {
+	assert(start + size <= a->size);
+
+	switch (a->width) {
+		case sizeof (uint):
+			return array_bsearch_u32(array_data_u32(a), start, start + size, value);
+		case sizeof (short):
+			return array_bsearch_u16(array_data_u16(a), start, start + size, value);
+		case sizeof (char):
+			return array_bsearch_u8(array_data_u8(a), start, start + size, value);
 	}
 
-	return left;
+	/* all values are zero */
+	return value ? start + size : start;
+}
+
+void array_copy_out(const struct array *a, uint start, uint size, uint *out) {
+	uint i = 0;
+
+	ARRAY_FOR_EACH_RANGE(a, start, size, v, out[i++] = v;);
+}
+
+static void hashtable_alloc(struct hashtable *h, uint size) {
+	h->ctrl = mem_realloc(h->arena, NULL, 0, size);
+	h->values = mem_realloc(h->arena, NULL, 0, size * sizeof (uint));
+	h->hashes = mem_realloc(h->arena, NULL, 0, size * sizeof (uint));
+	memset(h->ctrl, HASHTABLE_EMPTY, size);
+	h->mask = size - 1;
+	h->load = 0;
 }
 
 void hashtable_init(struct hashtable *h) {
+	hashtable_init_arena(h, NULL);
+}
+
+void hashtable_init_arena(struct hashtable *h, struct arena *arena) {
 	memset(h, 0, sizeof (struct hashtable));
-	array_init(&h->table, 0);
-	array_set_size(&h->table, 1);
+	h->arena = arena;
+	hashtable_alloc(h, HASHTABLE_GROUP);
 }
 
 void hashtable_clean(struct hashtable *h) {
-	array_clean(&h->table);
+	mem_free(h->arena, h->ctrl, h->mask + 1);
+	mem_free(h->arena, h->values, (h->mask + 1) * sizeof (uint));
+	mem_free(h->arena, h->hashes, (h->mask + 1) * sizeof (uint));
 	memset(h, 0, sizeof (struct hashtable));
 }
 
-static int hashtable_need_resize(const struct hashtable *h) {
-	return h->load * 2 + 1 >= array_get_size(&h->table);
+static inline int hashtable_need_resize(const struct hashtable *h) {
+	/* keep the load factor below 7/8 */
+	return (h->load + 1) * 8 > (h->mask + 1) * 7;
 }
 
-static inline uint getslot(uint hash, uint i, uint size) {
-	return (hash + (i + i * i) / 2) % size;
+/* spread the bits, the top 7 bits are used as tag, the low bits select group */
+static inline uint mixhash(uint hash) {
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+	return hash;
 }
 
-void hashtable_add_dir(struct hashtable *h, uint value, uint hash, uint iter) {
-	uint size = array_get_size(&h->table);
-	uint slot = getslot(hash, iter - 1, size);
+static inline unsigned char gettag(uint mixed) {
+	return mixed >> 25;
+}
 
-	assert(slot < array_get_size(&h->table));
-	assert(!hashtable_need_resize(h));
-	assert(!array_get(&h->table, slot));
-	h->load++;
-	array_set(&h->table, slot, value + 1);
+/* groups are probed in triangular sequence, which visits all of them */
+static inline uint getgroup(uint mixed, uint i, uint mask) {
+	return (mixed + (i + i * i) / 2 * HASHTABLE_GROUP) & mask & ~(HASHTABLE_GROUP - 1);
 }
 
-void hashtable_add(struct hashtable *h, uint value, uint hash) {
-	uint size = array_get_size(&h->table);
-	uint slot, v, m;
+/* bitmask of slots in the group with the tag */
+static inline uint group_match(const unsigned char *ctrl, unsigned char tag) {
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
 
-	assert(!hashtable_need_resize(h));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+	uint i, m;
 
-	for (m = 0; (v = array_get(&h->table, (slot = getslot(hash, m, size)))); m++)
-	       if (v - 1 == value)
-		       /* already stored */
-		       return;
-	
+	for (i = m = 0; i < HASHTABLE_GROUP; i++)
+		if (ctrl[i] == tag)
+			m |= 1 << i;
+	return m;
+#endif
+}
+
+/* bitmask of empty slots in the group */
+static inline uint group_empty(const unsigned char *ctrl) {
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+	uint i, m;
+
+	for (i = m = 0; i < HASHTABLE_GROUP; i++)
+		if (ctrl[i] & HASHTABLE_EMPTY)
+			m |= 1 << i;
+	return m;
+#endif
+}
+
+static void hashtable_set(struct hashtable *h, uint slot, uint value, uint mixed) {
+	assert(h->ctrl[slot] == HASHTABLE_EMPTY);
+	h->ctrl[slot] = gettag(mixed);
+	h->values[slot] = value;
+	h->hashes[slot] = mixed;
 	h->load++;
-	array_set(&h->table, slot, value + 1);
 }
 
-int hashtable_resize(struct hashtable *h) {
-	uint size = array_get_size(&h->table);
+/* move all entries to a table of new size using the stored hashes */
+static void hashtable_rehash(struct hashtable *h, uint size) {
+	unsigned char *ctrl = h->ctrl;
+	uint *values = h->values, *hashes = h->hashes;
+	uint i, j, group, empty, oldsize = h->mask + 1;
 
-	if (!hashtable_need_resize(h))
-		return 0;
+	hashtable_alloc(h, size);
 
-	array_zero(&h->table, 0, size);
+	for (i = 0; i < oldsize; i++) {
+		if (ctrl[i] & HASHTABLE_EMPTY)
+			continue;
+		for (j = 0; !(empty = group_empty(h->ctrl + (group = getgroup(hashes[i], j, h->mask)))); j++)
+			;
+		hashtable_set(h, group + __builtin_ctz(empty), values[i], hashes[i]);
+	}
 
-	while (h->load * 2 + 1 >= size)
-		size = size ? size * 2 : 16;
+	mem_free(h->arena, hashes, oldsize * sizeof (uint));
+	mem_free(h->arena, values, oldsize * sizeof (uint));
+	mem_free(h->arena, ctrl, oldsize);
+}
+
+/* iter holds the probe number and the next slot in the group */
+#define ITER_SLOTS 5
+
+void hashtable_add_dir(struct hashtable *h, uint value, uint hash, uint iter) {
+	uint mixed = mixhash(hash);
+	uint group = getgroup(mixed, iter >> ITER_SLOTS, h->mask);
+	uint empty = group_empty(h->ctrl + group);
 
-	array_set_size(&h->table, size);
 	assert(!hashtable_need_resize(h));
-	h->load = 0;
-	return 1;
+	assert(empty);
+	hashtable_set(h, group + __builtin_ctz(empty), value, mixed);
 }
 
-uint hashtable_find(const struct hashtable *h, uint hash, uint *iter) {
-	uint size = array_get_size(&h->table);
-	uint slot = getslot(hash, (*iter)++, size);
+void hashtable_reserve(struct hashtable *h, uint count) {
+	uint size = h->mask + 1;
+
+	while ((count + 1) * 8 > size * 7)
+		size *= 2;
+
+	if (size > h->mask + 1)
+		hashtable_rehash(h, size);
+}
+
+void hashtable_resize(struct hashtable *h) {
+	if (hashtable_need_resize(h))
+		hashtable_reserve(h, h->load + 1);
+}
 
-	return array_get(&h->table, slot) - 1;
+uint hashtable_find(const struct hashtable *h, uint hash, uint *iter) {
+	uint i, slot, group, match, mixed = mixhash(hash);
+	unsigned char tag = gettag(mixed);
+
+	for (i = *iter >> ITER_SLOTS, slot = *iter & ((1 << ITER_SLOTS) - 1); ; i++, slot = 0) {
+		group = getgroup(mixed, i, h->mask);
+		match = slot < HASHTABLE_GROUP ? group_match(h->ctrl + group, tag) >> slot << slot : 0;
+		for (; match; match &= match - 1) {
+			slot = __builtin_ctz(match);
+			if (h->hashes[group + slot] != mixed)
+				continue;
+			*iter = i << ITER_SLOTS | (slot + 1);
+			return h->values[group + slot];
+		}
+		if (group_empty(h->ctrl + group)) {
+			/* leave iter at the group for hashtable_add_dir() */
+			*iter = i << ITER_SLOTS | HASHTABLE_GROUP;
+			return -1;
+		}
+	}
 }
 
-static uint compute_stringhash(const char *s) {
+static uint compute_stringhash(const char *s, size_t len) {
 	uint r;
 
-	for (r = 0; *s; s++)
+	for (r = 0; len; s++, len--)
 		r = r * 27 + *s;
 
 	return r;
 }
 
-static void rebuild_hashtable(struct strings *h) {
-	uint i, hash;
-	
-	for (i = strings_get_first(h); i != -1; i = strings_get_next(h, i)) {
-		hash = compute_stringhash(h->strings + i);
-		hashtable_add(&h->hashtable, i, hash);
-	}
-}
-
 static void resize_strings(struct strings *h, uint minsize) {
-	while (minsize > h->alloced)
-		if (h->alloced < 16)
-			h->alloced = 16;
+	uint alloced = h->alloced;
+
+	while (minsize > alloced)
+		if (alloced < 16)
+			alloced = 16;
 		else
-			h->alloced *= 2;
-	h->strings = realloc(h->strings, h->alloced);
+			alloced *= 2;
+	h->strings = mem_realloc(h->offsets.arena, h->strings, h->alloced, alloced);
+	h->alloced = alloced;
 }
 
 void strings_init(struct strings *strs) {
+	strings_init_arena(strs, NULL);
+}
+
+/* the string data, offsets and hashtable are all allocated in the arena */
+void strings_init_arena(struct strings *strs, struct arena *arena) {
 	memset(strs, 0, sizeof (struct strings));
-	hashtable_init(&strs->hashtable);
+	array_init_arena(&strs->offsets, 0, arena);
+	hashtable_init_arena(&strs->hashtable, arena);
+}
+
+void strings_reserve(struct strings *strs, uint count, uint size) {
+	hashtable_reserve(&strs->hashtable, count);
+	array_reserve(&strs->offsets, count, size);
+	if (strs->alloced < size)
+		resize_strings(strs, size);
 }
 
 void strings_clean(struct strings *strs) {
-	free(strs->strings);
+	mem_free(strs->offsets.arena, strs->strings, strs->alloced);
+	array_clean(&strs->offsets);
 	hashtable_clean(&strs->hashtable);
 	memset(strs, 0, sizeof (struct strings));
 }
 
 uint strings_add(struct strings *strs, const char *s) {
-	uint hash = compute_stringhash(s);
+	return strings_add_len(strs, s, strlen(s));
+}
+
+/* add string which doesn't have to be terminated */
+uint strings_add_len(struct strings *strs, const char *s, size_t len) {
+	uint hash = compute_stringhash(s, len);
 	uint i, iter = 0;
-	size_t len;
 	
-	if (hashtable_resize(&strs->hashtable))
-		rebuild_hashtable(strs);
+	hashtable_resize(&strs->hashtable);
 
 	while ((i = hashtable_find(&strs->hashtable, hash, &iter)) != -1)
-	       if (!strcmp(s, strs->strings + i))
+	       if (strings_get_len(strs, i) == len && !memcmp(s, strings_get(strs, i), len))
 		       break;
 
 	if (i != -1)
 		/* string already stored */
 		return i;
 
-	len = strlen(s);
 	if (strs->alloced - strs->used <= len)
 	       resize_strings(strs, strs->used + len + 1);
 
-	i = strs->used;
+	i = array_get_size(&strs->offsets);
+	array_set(&strs->offsets, i, strs->used);
 	hashtable_add_dir(&strs->hashtable, i, hash, iter);
+	memcpy(strs->strings + strs->used, s, len);
+	strs->strings[strs->used + len] = '\0';
 	strs->used += len + 1;
-	strcpy(strs->strings + i, s);
 	return i;
 }
 
-uint strings_get_id(const struct strings *strs, const char *s) {
-	uint hash = compute_stringhash(s);
+static uint strings_find(const struct strings *strs, const char *s, uint hash) {
 	uint i, iter = 0;
 	
 	while ((i = hashtable_find(&strs->hashtable, hash, &iter)) != -1)
@@ -353,47 +857,228 @@ uint strings_get_id(const struct strings *strs, const char *s) {
 	return i;
 }
 
+uint strings_get_id(const struct strings *strs, const char *s) {
+	return strings_find(strs, s, compute_stringhash(s, strlen(s)));
+}
+
+uint strings_get_size(const struct strings *strs) {
+	return array_get_size(&strs->offsets);
+}
+
 uint strings_get_first(const struct strings *strs) {
-	if (strs->used)
+	if (strings_get_size(strs))
 		return 0;
 	return -1;
 }
 
 uint strings_get_next(const struct strings *strs, uint i) {
-	size_t len;
+	assert(i < strings_get_size(strs));
 
-	assert(strs->strings != NULL);
-	assert(i < strs->used);
-
-	len = strlen(strs->strings + i);
-
-	if (i + len + 1 >= strs->used)
+	if (i + 1 >= strings_get_size(strs))
 		return -1;
-	return i + len + 1;
+	return i + 1;
 }
 
 const char *strings_get(const struct strings *strs, uint i) {
 	assert(strs->strings != NULL);
-	assert(i < strs->used);
 
-	return strs->strings + i;
+	return strs->strings + array_get(&strs->offsets, i);
+}
+
+uint strings_get_len(const struct strings *strs, uint i) {
+	uint end;
+
+	if (i + 1 < strings_get_size(strs))
+		end = array_get(&strs->offsets, i + 1);
+	else
+		end = strs->used;
+
+	return end - array_get(&strs->offsets, i) - 1;
+}
+
+/* file in struct paths and the value it was added with */
+struct paths_file {
+	uint dir;
+	uint base;
+	uint value;
+};
+
+/* bits of the filter per basename and bits set in the block */
+#define PATHS_FILTER_BITS 16
+#define PATHS_FILTER_K 4
+
+void paths_init(struct paths *paths) {
+	memset(paths, 0, sizeof (struct paths));
+	strings_init(&paths->dirs);
+	strings_init(&paths->bases);
+	array_init(&paths->files, sizeof (struct paths_file));
+	hashtable_init(&paths->hashtable);
+}
+
+void paths_clean(struct paths *paths) {
+	strings_clean(&paths->dirs);
+	strings_clean(&paths->bases);
+	array_clean(&paths->files);
+	hashtable_clean(&paths->hashtable);
+	free(paths->filter);
+	memset(paths, 0, sizeof (struct paths));
+}
+
+/* the block is selected by the mixed string hash, the bits by another mix of it */
+static inline uint64_t filter_bits(uint mixed) {
+	uint64_t bits = 0;
+	uint i, h = mixhash(mixed ^ 0x5bd1e995);
+
+	for (i = 0; i < PATHS_FILTER_K; i++, h >>= 6)
+		bits |= 1ULL << (h & 63);
+
+	return bits;
+}
+
+static inline uint pathhash(uint dir, uint base) {
+	return dir * 31 + base;
+}
+
+/* directories are stored with the trailing slash, paths without basename are ignored */
+int paths_add(struct paths *paths, const char *path, uint value) {
+	const char *base;
+	struct paths_file file;
+	uint i, iter = 0, hash;
+
+	base = strrchr(path, '/');
+	if (base == NULL || base[1] == '\0' || !strcmp(base + 1, "."))
+		return 1;
+	base++;
+
+	file.dir = strings_add_len(&paths->dirs, path, base - path);
+	file.base = strings_add(&paths->bases, base);
+	file.value = value;
+
+	if (paths->filter != NULL) {
+		/* keep the filter valid, it's just less effective */
+		uint mixed = mixhash(compute_stringhash(base, strlen(base)));
+
+		paths->filter[mixed & paths->filter_mask] |= filter_bits(mixed);
+	}
+
+	hash = pathhash(file.dir, file.base);
+
+	hashtable_resize(&paths->hashtable);
+
+	while ((i = hashtable_find(&paths->hashtable, hash, &iter)) != -1) {
+		const struct paths_file *f = ASGETPTR(paths_file, &paths->files, i);
+
+		if (f->dir == file.dir && f->base == file.base)
+			/* already stored */
+			return 0;
+	}
+
+	i = array_get_size(&paths->files);
+	*ASGETWPTR(paths_file, &paths->files, i) = file;
+	hashtable_add_dir(&paths->hashtable, i, hash, iter);
+
+	return 0;
 }
 
+/* build the basename filter sized for the stored basenames */
+void paths_finalize(struct paths *paths) {
+	uint i, n, size, mixed;
+
+	n = strings_get_size(&paths->bases);
+	for (size = 1; size * 64 < n * PATHS_FILTER_BITS; size *= 2)
+		;
+
+	free(paths->filter);
+	paths->filter = calloc(size, sizeof (uint64_t));
+	paths->filter_mask = size - 1;
+
+	for (i = 0; i < n; i++) {
+		mixed = mixhash(compute_stringhash(strings_get(&paths->bases, i),
+					strings_get_len(&paths->bases, i)));
+		paths->filter[mixed & paths->filter_mask] |= filter_bits(mixed);
+	}
+}
+
+uint paths_get_size(const struct paths *paths) {
+	return array_get_size(&paths->files);
+}
+
+uint paths_get_value(const struct paths *paths, uint i) {
+	return ASGETPTR(paths_file, &paths->files, i)->value;
+}
+
+uint paths_find_dir(const struct paths *paths, const char *dir) {
+	return strings_get_id(&paths->dirs, dir);
+}
+
+/* most basenames of installed files are not required, check the filter first */
+uint paths_find_base(struct paths *paths, const char *base) {
+	uint hash = compute_stringhash(base, strlen(base)), mixed, id;
+	uint64_t bits;
+
+	paths->stats.lookups++;
+
+	if (paths->filter != NULL) {
+		mixed = mixhash(hash);
+		bits = filter_bits(mixed);
+		if ((paths->filter[mixed & paths->filter_mask] & bits) != bits) {
+			paths->stats.rejected++;
+			return -1;
+		}
+	}
+
+	id = strings_find(&paths->bases, base, hash);
+	if (id == -1 && paths->filter != NULL)
+		paths->stats.false_positives++;
+
+	return id;
+}
+
+/* return value of the file with the directory and basename ids or -1 */
+uint paths_find(const struct paths *paths, uint dir, uint base) {
+	const struct paths_file *f;
+	uint i, iter = 0;
+
+	while ((i = hashtable_find(&paths->hashtable, pathhash(dir, base), &iter)) != -1) {
+		f = ASGETPTR(paths_file, &paths->files, i);
+		if (f->dir == dir && f->base == base)
+			return f->value;
+	}
+
+	return -1;
+}
+
+/* value waiting in sets_append() for sets_finalize() */
+struct sets_entry {
+	uint set;
+	uint subset;
+	uint value;
+};
+
 void sets_init(struct sets *sets) {
+	sets_init_arena(sets, NULL);
+}
+
+/* values appended by sets_append() are kept out of the arena until finalized */
+void sets_init_arena(struct sets *sets, struct arena *arena) {
 	memset(sets, 0, sizeof (struct sets));
-	array_init(&sets->ints, 0);
-	array_init(&sets->sets_first, 0);
-	array_init(&sets->sets_size, 0);
-	array_init(&sets->hashtable, 0);
-	array_init(&sets->subsets, 0);
+	array_init_arena(&sets->ints, 0, arena);
+	array_init_arena(&sets->sets_first, 0, arena);
+	array_init_arena(&sets->sets_size, 0, arena);
+	array_init_arena(&sets->subsets, 0, arena);
+	array_init_arena(&sets->index_first, 0, arena);
+	array_init_arena(&sets->index_sets, 0, arena);
+	array_init(&sets->pending, sizeof (struct sets_entry));
 }
 
 void sets_clean(struct sets *sets) {
 	array_clean(&sets->ints);
 	array_clean(&sets->sets_first);
 	array_clean(&sets->sets_size);
-	array_clean(&sets->hashtable);
 	array_clean(&sets->subsets);
+	array_clean(&sets->index_first);
+	array_clean(&sets->index_sets);
+	array_clean(&sets->pending);
 	memset(sets, 0, sizeof (struct sets));
 }
 
@@ -420,8 +1105,8 @@ static uint subset_get_last(const struct sets *sets, uint set, uint subset) {
 uint sets_add(struct sets *sets, uint set, uint subset, uint value) {
 	uint i, size, first, subsets, sub_first, sub_size;
 
-	/* don't add when hashtable is created */
-	assert(!array_get_size(&sets->hashtable));
+	/* don't add when index is created */
+	assert(!array_get_size(&sets->index_first));
 
 	/* adding only to the last set or creating new one is supported */
 	assert(set + 1 >= array_get_size(&sets->sets_first));
@@ -491,8 +1176,144 @@ uint sets_add(struct sets *sets, uint set, uint subset, uint value) {
 	return i - sub_first;
 }
 
+void sets_append(struct sets *sets, uint set, uint subset, uint value) {
+	struct sets_entry *e;
+
+	/* don't add when index is created */
+	assert(!array_get_size(&sets->index_first));
+
+	e = ASGETWPTR(sets_entry, &sets->pending, array_get_size(&sets->pending));
+	e->set = set;
+	e->subset = subset;
+	e->value = value;
+
+	if (sets->pending_sets <= set)
+		sets->pending_sets = set + 1;
+}
+
+static int compare_entries(const void *p1, const void *p2) {
+	const struct sets_entry *e1 = p1, *e2 = p2;
+
+	if (e1->set != e2->set)
+		return e1->set < e2->set ? -1 : 1;
+	if (e1->subset != e2->subset)
+		return e1->subset < e2->subset ? -1 : 1;
+	if (e1->value != e2->value)
+		return e1->value < e2->value ? -1 : 1;
+	return 0;
+}
+
+/* sort values added by sets_append() into the sets in one pass */
+void sets_finalize(struct sets *sets) {
+	struct array ints, sets_first, sets_size, subsets;
+	const struct sets_entry *e;
+	uint i, j, k, n, s, size, first, subs, nsets, max;
+
+	if (!array_get_size(&sets->pending))
+		return;
+
+	assert(!array_get_size(&sets->index_first));
+
+	nsets = sets_get_size(sets);
+
+	/* values already stored are sorted again with the new ones */
+	n = array_get_size(&sets->sets_first);
+	for (i = 0; i < n; i++) {
+		subs = array_get(&sets->subsets, i);
+		for (j = 0; j <= subs; j++) {
+			s = sets_get_subset_size(sets, i, j);
+			for (k = 0; k < s; k++)
+				sets_append(sets, i, j, sets_get(sets, i, j, k));
+		}
+	}
+
+	n = array_get_size(&sets->pending);
+	qsort(array_get_wptr(&sets->pending, 0), n, sizeof (struct sets_entry), compare_entries);
+
+	for (i = max = 0; i < n; i++)
+		max = MAX(max, ASGETPTR(sets_entry, &sets->pending, i)->value);
+
+	/* size the arrays for the final width, subset offsets are below n */
+	array_init_arena(&ints, 0, sets->ints.arena);
+	array_init_arena(&sets_first, 0, sets->ints.arena);
+	array_init_arena(&sets_size, 0, sets->ints.arena);
+	array_init_arena(&subsets, 0, sets->ints.arena);
+	array_reserve(&ints, n, MAX(max, n));
+	array_reserve(&sets_first, nsets, n);
+	array_reserve(&sets_size, nsets, n);
+
+	for (s = i = 0; s < nsets; s++) {
+		subs = s < array_get_size(&sets->subsets) ? array_get(&sets->subsets, s) : 0;
+		for (j = i; j < n && ASGETPTR(sets_entry, &sets->pending, j)->set == s; j++)
+			subs = MAX(subs, ASGETPTR(sets_entry, &sets->pending, j)->subset);
+
+		first = array_get_size(&ints);
+		array_set_size(&ints, first + subs);
+
+		for (j = 0, size = subs; j <= subs; j++) {
+			if (j)
+				array_set(&ints, first + j - 1, size);
+			for (k = size; i < n; i++) {
+				e = ASGETPTR(sets_entry, &sets->pending, i);
+				if (e->set != s || e->subset != j)
+					break;
+				if (size > k && array_get(&ints, first + size - 1) == e->value)
+					/* duplicate */
+					continue;
+				array_set(&ints, first + size++, e->value);
+			}
+		}
+
+		array_set(&sets_first, s, first);
+		array_set(&sets_size, s, size);
+		array_set(&subsets, s, subs);
+	}
+	array_shrink(&ints);
+
+	array_clean(&sets->ints);
+	array_clean(&sets->sets_first);
+	array_clean(&sets->sets_size);
+	array_clean(&sets->subsets);
+	array_clean(&sets->pending);
+	array_init(&sets->pending, sizeof (struct sets_entry));
+
+	sets->ints = ints;
+	sets->sets_first = sets_first;
+	sets->sets_size = sets_size;
+	sets->subsets = subsets;
+	sets->pending_sets = 0;
+}
+
+/* copy set from other sets, only a new last set can be created in dest */
+#define COPY_BUF_SIZE 256
+
+void sets_copy_set(struct sets *dest, uint set, const struct sets *source, uint source_set) {
+	uint first, size, n, buf[COPY_BUF_SIZE];
+
+	assert(!array_get_size(&dest->index_first));
+	assert(set >= array_get_size(&dest->sets_first));
+
+	if (source_set >= array_get_size(&source->sets_first))
+		return;
+	size = array_get(&source->sets_size, source_set);
+	if (!size)
+		return;
+	first = array_get(&source->sets_first, source_set);
+
+	/* offsets of subsets are relative to the set, they are copied as they are */
+	array_set(&dest->sets_first, set, array_get_size(&dest->ints));
+	array_set(&dest->sets_size, set, size);
+	array_set(&dest->subsets, set, array_get(&source->subsets, source_set));
+
+	for (; size; first += n, size -= n) {
+		n = MIN(size, COPY_BUF_SIZE);
+		array_copy_out(&source->ints, first, n, buf);
+		array_append_n(&dest->ints, buf, n);
+	}
+}
+
 void sets_set_size(struct sets *sets, uint size) {
-	assert(!array_get_size(&sets->hashtable));
+	assert(!array_get_size(&sets->index_first));
 
 	array_set_size(&sets->sets_first, size);
 	array_set_size(&sets->sets_size, size);
@@ -500,7 +1321,7 @@ void sets_set_size(struct sets *sets, uint size) {
 }
 
 uint sets_get_size(const struct sets *sets) {
-	return array_get_size(&sets->sets_first);
+	return MAX(array_get_size(&sets->sets_first), sets->pending_sets);
 }
 
 uint sets_get_set_size(const struct sets *sets, uint set) {
@@ -519,6 +1340,20 @@ uint sets_get_subset_size(const struct sets *sets, uint set, uint subset) {
 	return array_get(&sets->sets_size, set);
 }
 
+void sets_get_range(const struct sets *sets, uint set, uint subset, uint *start, uint *end) {
+	uint first;
+
+	if (set >= array_get_size(&sets->sets_first) ||
+			subset > array_get(&sets->subsets, set)) {
+		*start = *end = 0;
+		return;
+	}
+
+	first = array_get(&sets->sets_first, set);
+	*start = first + subset_get_first(sets, set, subset);
+	*end = first + subset_get_last(sets, set, subset);
+}
+
 uint sets_get(const struct sets *sets, uint set, uint subset, uint index) {
 	uint set_first = array_get(&sets->sets_first, set), sub_first = 0;
 	uint subsets = array_get(&sets->subsets, set);
@@ -532,15 +1367,11 @@ uint sets_get(const struct sets *sets, uint set, uint subset, uint index) {
 }
 
 int sets_subset_has(const struct sets *sets, uint set, uint subset, uint value) {
-	uint i;
-	uint first = array_get(&sets->sets_first, set);
-	uint sub_first = subset_get_first(sets, set, subset);
-	uint sub_last = subset_get_last(sets, set, subset);
+	uint i, first, last;
 
-	i = array_bsearch(&sets->ints, first + sub_first, sub_last - sub_first, value);
-	if (i < first + sub_first + sub_last - sub_first && array_get(&sets->ints, i) == value)
-		return 1;
-	return 0;
+	sets_get_range(sets, set, subset, &first, &last);
+	i = array_bsearch(&sets->ints, first, last - first, value);
+	return i < last && array_get(&sets->ints, i) == value;
 }
 
 int sets_has(const struct sets *sets, uint set, uint value) {
@@ -560,109 +1391,251 @@ int sets_has(const struct sets *sets, uint set, uint value) {
 	return i < first + size && array_get(&sets->ints, i) == value;
 }
 
-static uint inthash(uint i) {
-	return 13 * i << 8 ^ i;
-}
+/* build index of sets containing each value, sorted by set */
+void sets_index(struct sets *sets) {
+	struct array last, pos;
+	uint i, j, k, n, s, v, start, end, subs, values;
 
-void sets_hash(struct sets *sets) {
-	struct array t1, t2;
-	uint hash, i, j, index, last, slot, oslot, value, s;
+	assert(!array_get_size(&sets->pending));
 
-	for (s = 16; s < array_get_size(&sets->ints) * 2; s *= 2)
-		;
+	n = array_get_size(&sets->sets_first);
+
+	for (i = values = 0; i < n; i++) {
+		subs = array_get(&sets->subsets, i);
+		for (j = 0; j <= subs; j++) {
+			sets_get_range(sets, i, j, &start, &end);
+			for (k = start; k < end; k++)
+				values = MAX(values, array_get(&sets->ints, k) + 1);
+		}
+	}
 
-	array_set_size(&sets->hashtable, s);
-	array_init(&t1, 0);
-	array_init(&t2, 0);
-	array_set_size(&t1, s);
-	array_set_size(&t2, s);
-
-	for (i = 0; i < array_get_size(&sets->sets_first); i++) {
-		index = array_get(&sets->sets_first, i) + array_get(&sets->subsets, i);
-		last = index + array_get(&sets->sets_size, i) - array_get(&sets->subsets, i);
-		for ( ;	index < last; index++) {
-			value = array_get(&sets->ints, index);
-			hash = inthash(value);
-			j = 0;
-			oslot = slot = getslot(hash, j, s);
-			if (array_get(&t2, slot) == value) {
-				/* shortcut */
-				j = array_get(&t1, slot);
-				slot = getslot(hash, j, s);
+	array_init(&last, 0);
+	array_init(&pos, 0);
+	array_set_size(&last, values);
+	array_set_size(&pos, values + 1);
+
+	/* count sets containing each value */
+	for (i = 0; i < n; i++) {
+		subs = array_get(&sets->subsets, i);
+		for (j = 0; j <= subs; j++) {
+			sets_get_range(sets, i, j, &start, &end);
+			for (k = start; k < end; k++) {
+				v = array_get(&sets->ints, k);
+				if (array_get(&last, v) == i + 1)
+					continue;
+				array_set(&last, v, i + 1);
+				array_inc(&pos, v + 1, 1);
 			}
-			while (array_get(&sets->hashtable, slot)) {
-				j++;
-				slot = getslot(hash, j, s);
-			}	
-
-			array_set(&sets->hashtable, slot, i + 1);
-			array_set(&t1, oslot, j + 1);
-			array_set(&t2, oslot, value);
 		}
 	}
-	array_clean(&t2);
-	array_clean(&t1);
+	array_clean(&last);
+
+	for (v = s = 0; v <= values; v++) {
+		s += array_get(&pos, v);
+		array_set(&pos, v, s);
+	}
+
+	array_clone(&sets->index_first, &pos);
+	array_set_size(&sets->index_sets, s);
+
+	/* place the sets, a set is kept only once for a value */
+	for (i = 0; i < n; i++) {
+		subs = array_get(&sets->subsets, i);
+		for (j = 0; j <= subs; j++) {
+			sets_get_range(sets, i, j, &start, &end);
+			for (k = start; k < end; k++) {
+				v = array_get(&sets->ints, k);
+				s = array_get(&pos, v);
+				if (s > array_get(&sets->index_first, v) &&
+						array_get(&sets->index_sets, s - 1) == i)
+					continue;
+				array_set(&sets->index_sets, s, i);
+				array_set(&pos, v, s + 1);
+			}
+		}
+	}
+	array_clean(&pos);
+}
+
+uint sets_find_size(const struct sets *sets, uint value) {
+	if (value + 1 >= array_get_size(&sets->index_first))
+		return 0;
+	return array_get(&sets->index_first, value + 1) - array_get(&sets->index_first, value);
+}
+
+uint sets_find_set(const struct sets *sets, uint value, uint index) {
+	assert(index < sets_find_size(sets, value));
+	return array_get(&sets->index_sets, array_get(&sets->index_first, value) + index);
 }
 
 uint sets_find(const struct sets *sets, uint value, uint *iter) {
-	uint i, s, h;
+	if (*iter >= sets_find_size(sets, value))
+		return -1;
+	return sets_find_set(sets, value, (*iter)++);
+}
 
-	s = array_get_size(&sets->hashtable);
-	h = inthash(value);
+static void combine(struct sets *dest, struct arena *arena,
+		const struct sets *sets1, const struct sets *sets2, int op) {
+	uint i, j, n, n1, n2, s1, e1, s2, e2, v1, v2, size, first, subs, subs1, subs2;
+	struct array *ints = &dest->ints;
 
-	while ((i = array_get(&sets->hashtable, getslot(h, (*iter)++, s))) &&
-			!sets_has(sets, i - 1, value))
-		;
-	return i - 1;
+	assert(dest != sets1 && dest != sets2);
+	assert(!array_get_size(&sets1->pending) && !array_get_size(&sets2->pending));
+
+	sets_init_arena(dest, arena);
+
+	n1 = array_get_size(&sets1->sets_first);
+	n2 = array_get_size(&sets2->sets_first);
+	switch (op) {
+		case SETS_UNION: n = MAX(n1, n2); break;
+		case SETS_INTERSECTION: n = MIN(n1, n2); break;
+		default: n = n1; break;
+	}
+
+	/* the result can't be larger or have larger values than the sources */
+	size = array_get_size(&sets1->ints) + array_get_size(&sets2->ints);
+	array_reserve(ints, size, MAX(size, MAX(array_get_max(&sets1->ints),
+					array_get_max(&sets2->ints))));
+	array_reserve(&dest->sets_first, n, size);
+	array_reserve(&dest->sets_size, n, size);
+
+	for (i = 0; i < n; i++) {
+		subs1 = i < n1 ? array_get(&sets1->subsets, i) : 0;
+		subs2 = i < n2 ? array_get(&sets2->subsets, i) : 0;
+		switch (op) {
+			case SETS_UNION: subs = MAX(subs1, subs2); break;
+			case SETS_INTERSECTION: subs = MIN(subs1, subs2); break;
+			default: subs = subs1; break;
+		}
+
+		first = array_get_size(ints);
+		array_set_size(ints, first + subs);
+
+		for (j = 0, size = subs; j <= subs; j++) {
+			if (j)
+				array_set(ints, first + j - 1, size);
+
+			sets_get_range(sets1, i, j, &s1, &e1);
+			sets_get_range(sets2, i, j, &s2, &e2);
+
+			/* walk both sorted subsets at once */
+			while (s1 < e1 || s2 < e2) {
+				v1 = s1 < e1 ? array_get(&sets1->ints, s1) : -1;
+				v2 = s2 < e2 ? array_get(&sets2->ints, s2) : -1;
+
+				if (s1 < e1 && (s2 >= e2 || v1 < v2)) {
+					if (op != SETS_INTERSECTION)
+						array_set(ints, first + size++, v1);
+					s1++;
+				} else if (s2 < e2 && (s1 >= e1 || v2 < v1)) {
+					if (op == SETS_UNION)
+						array_set(ints, first + size++, v2);
+					s2++;
+				} else {
+					if (op != SETS_DIFFERENCE)
+						array_set(ints, first + size++, v1);
+					s1++;
+					s2++;
+				}
+			}
+		}
+
+		array_set(&dest->sets_first, i, first);
+		array_set(&dest->sets_size, i, size);
+		array_set(&dest->subsets, i, subs);
+	}
+	array_shrink(ints);
 }
 
-void sets_unhash(struct sets *sets) {
-	array_clean(&sets->hashtable);
+void sets_combine(struct sets *dest, const struct sets *sets1, const struct sets *sets2, int op) {
+	combine(dest, NULL, sets1, sets2, op);
 }
 
 void sets_merge(struct sets *dest, const struct sets *source) {
-	uint sets1, sets2, sets, s, i, j, k;
 	struct sets tmp;
 
-	assert(!array_get_size(&dest->hashtable));
- 
-	sets1 = array_get_size(&dest->sets_first);
-	sets2 = array_get_size(&source->sets_first);
-	sets = MAX(sets1, sets2);
+	assert(!array_get_size(&dest->index_first));
 
-	sets_clone(&tmp, dest);
+	combine(&tmp, dest->ints.arena, dest, source, SETS_UNION);
 	sets_clean(dest);
-	sets_init(dest);
+	*dest = tmp;
+}
 
-	for (i = 0; i < sets; i++) {
-		uint subs, subs1, subs2;
+/*
+ * Fill empty dest with the transposed sets of source. Set i of source with
+ * value v in subset 0 puts i to subset 0 of set v in dest, values from all
+ * other subsets go to subset 1. The values must be smaller than size.
+ */
+void sets_transpose(struct sets *dest, const struct sets *source, uint size) {
+	uint i, j, n, subsets, total, first, *hard, *alts, *last;
+
+	assert(!array_get_size(&dest->sets_first) && !array_get_size(&dest->pending));
+
+	n = sets_get_size(source);
+	hard = calloc(size, sizeof (uint));
+	alts = calloc(size, sizeof (uint));
+	last = calloc(size, sizeof (uint));
+
+	/* count values of each set in dest, alternatives only once per source set */
+	for (i = 0; i < n; i++) {
+		SETS_FOR_EACH(source, i, 0, v,
+			assert(v < size);
+			hard[v]++;
+		);
+		subsets = sets_get_subsets(source, i);
+		for (j = 1; j < subsets; j++)
+			SETS_FOR_EACH(source, i, j, v,
+				assert(v < size);
+				if (last[v] != i + 1) {
+					last[v] = i + 1;
+					alts[v]++;
+				}
+			);
+	}
 
-	        subs1 = i < sets1 ? array_get(&tmp.subsets, i) : 0;
-		subs2 = i < sets2 ? array_get(&source->subsets, i) : 0;
-		subs = MAX(subs1, subs2);
+	for (i = total = 0; i < size; i++)
+		total += hard[i] + alts[i] + (alts[i] ? 1 : 0);
+
+	array_reserve(&dest->ints, total, MAX(n, total));
+	array_reserve(&dest->sets_first, size, total);
+	array_reserve(&dest->sets_size, size, total);
+	array_reserve(&dest->subsets, size, 1);
+	array_set_size(&dest->ints, total);
+
+	/* turn the counts into positions where the values will be written */
+	for (i = first = 0; i < size; i++) {
+		subsets = alts[i] ? 1 : 0;
+		array_set(&dest->sets_first, i, first);
+		array_set(&dest->sets_size, i, subsets + hard[i] + alts[i]);
+		array_set(&dest->subsets, i, subsets);
+		if (subsets)
+			array_set(&dest->ints, first, subsets + hard[i]);
+		j = first + subsets;
+		first = j + hard[i] + alts[i];
+		alts[i] = j + hard[i];
+		hard[i] = j;
+	}
 
-		for (j = 0; j <= subs; j++) {
-			if (i < sets1 && j <= subs1) {
-				s = sets_get_subset_size(&tmp, i, j);
-				for (k = 0; k < s; k++)
-					sets_add(dest, i, j, sets_get(&tmp, i, 0, k));
-			}
-			if (i < sets2 && j <= subs2) {
-				s = sets_get_subset_size(source, i, j);
-				for (k = 0; k < s; k++)
-					sets_add(dest, i, j, sets_get(source, i, 0, k));
-			}
-		}
+	memset(last, 0, size * sizeof (uint));
+
+	/* source sets are scanned in order, so the values are sorted */
+	for (i = 0; i < n; i++) {
+		SETS_FOR_EACH(source, i, 0, v,
+			array_set(&dest->ints, hard[v]++, i);
+		);
+		subsets = sets_get_subsets(source, i);
+		for (j = 1; j < subsets; j++)
+			SETS_FOR_EACH(source, i, j, v,
+				if (last[v] != i + 1) {
+					last[v] = i + 1;
+					array_set(&dest->ints, alts[v]++, i);
+				}
+			);
 	}
-	sets_clean(&tmp);
-}
 
-void sets_clone(struct sets *dest, const struct sets *source) {
-	sets_init(dest);
-	array_clone(&dest->ints, &source->ints);
-	array_clone(&dest->sets_first, &source->sets_first);
-	array_clone(&dest->sets_size, &source->sets_size);
-	array_clone(&dest->subsets, &source->subsets);
+	free(last);
+	free(alts);
+	free(hard);
 }
 
 int sets_subsetcmp(const struct sets *sets1, uint set1, uint subset1,
@@ -19,6 +19,7 @@
 #define _MISC_H_
 
 #include <assert.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
@@ -27,6 +28,28 @@
 #define ASGETPTR(s, a, i) ((const struct s *)array_get_ptr(a, i))
 #define ASGETWPTR(s, a, i) ((struct s *)array_get_wptr(a, i))
 
+struct arena_chunk;
+
+#define ARENA_CLASSES 16
+
+/* region of memory chunks which are released all at once */
+struct arena {
+	struct arena_chunk *chunks;
+	struct arena_chunk *free;
+	size_t chunk_size;
+	/* large blocks mapped separately */
+	struct arena_chunk *large;
+	/* freed blocks, class n has blocks of at least 2^n bytes */
+	void *free_blocks[ARENA_CLASSES];
+};
+
+void arena_init(struct arena *arena);
+void arena_clean(struct arena *arena);
+void arena_reset(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size, size_t size);
+void arena_free(struct arena *arena, void *ptr, size_t size);
+
 /* array of integers or fixed sized objects */
 struct array {
 	uint *array;
@@ -34,9 +57,11 @@ struct array {
 	uint alloced;
 	unsigned char width;
 	unsigned char fixed;
+	struct arena *arena;
 };
 
 void array_init(struct array *a, unsigned char width);
+void array_init_arena(struct array *a, unsigned char width, struct arena *arena);
 void array_clean(struct array *a);
 void array_zero(struct array *a, uint start, uint size);
 void array_set(struct array *a, uint index, uint value);
@@ -45,68 +70,189 @@ void array_inc(struct array *a, uint index, int inc);
 void *array_get_wptr(struct array *a, uint index);
 const void *array_get_ptr(const struct array *a, uint index);
 void array_set_size(struct array *a, uint size);
+void array_reserve(struct array *a, uint count, uint max_value);
+void array_append(struct array *a, uint value);
+void array_append_n(struct array *a, const uint *values, uint n);
+void array_shrink(struct array *a);
 uint array_get_size(const struct array *a);
 void array_clone(struct array *dest, const struct array *source);
 void array_move(struct array *a, uint dest, uint source, uint size);
 uint array_bsearch(const struct array *a, uint start, uint size, uint value);
+void array_copy_out(const struct array *a, uint start, uint size, uint *out);
+
+/* accessors and kernels specialized for the width of values */
+#define ARRAY_DEFINE_TYPED(type, suffix)					\
+static inline const type *array_data_##suffix(const struct array *a) {		\
+	assert(a->width == sizeof (type));					\
+	return (const type *)a->array;						\
+}										\
+										\
+uint array_bsearch_##suffix(const type *a, uint left, uint right, uint value);
+
+ARRAY_DEFINE_TYPED(unsigned char, u8)
+ARRAY_DEFINE_TYPED(unsigned short, u16)
+ARRAY_DEFINE_TYPED(uint, u32)
+
+#define ARRAY_LOOP_TYPED(type, a, start, end, v, ...)				\
+	do {									\
+		const type *_data = (const type *)(a)->array;			\
+		uint _i;							\
+										\
+		for (_i = (start); _i < (end); _i++) {				\
+			uint v = _data[_i];					\
+			__VA_ARGS__						\
+		}								\
+	} while (0)
+
+/* run the statements for each value in the range, width is checked only once */
+#define ARRAY_FOR_EACH_RANGE(a, start, size, v, ...)				\
+	do {									\
+		uint _start = (start), _end = _start + (size);			\
+										\
+		assert(_end <= array_get_size(a));				\
+		switch ((a)->width) {						\
+			case sizeof (uint):					\
+				ARRAY_LOOP_TYPED(uint, a, _start, _end, v, __VA_ARGS__); \
+				break;						\
+			case sizeof (short):					\
+				ARRAY_LOOP_TYPED(unsigned short, a, _start, _end, v, __VA_ARGS__); \
+				break;						\
+			case sizeof (char):					\
+				ARRAY_LOOP_TYPED(unsigned char, a, _start, _end, v, __VA_ARGS__); \
+				break;						\
+			default:						\
+				for (; _start < _end; _start++) {		\
+					uint v = 0;				\
+					__VA_ARGS__				\
+				}						\
+		}								\
+	} while (0)
+
+#define HASHTABLE_GROUP 16
+#define HASHTABLE_EMPTY 0x80
 
+/* open addressing with 7-bit hash tags probed in groups of slots */
 struct hashtable {
-	struct array table;
+	unsigned char *ctrl;
+	uint *values;
+	uint *hashes;
+	uint mask;
 	uint load;
+	struct arena *arena;
 };
 
 void hashtable_init(struct hashtable *h);
+void hashtable_init_arena(struct hashtable *h, struct arena *arena);
 void hashtable_clean(struct hashtable *h);
 void hashtable_add_dir(struct hashtable *h, uint value, uint hash, uint iter);
-void hashtable_add(struct hashtable *h, uint value, uint hash);
-int hashtable_resize(struct hashtable *h);
+void hashtable_reserve(struct hashtable *h, uint count);
+void hashtable_resize(struct hashtable *h);
 uint hashtable_find(const struct hashtable *h, uint hash, uint *iter);
 
-/* set of strings */
+/* set of strings with sequential ids */
 struct strings {
 	char *strings;
 	uint used;
 	uint alloced;
+	struct array offsets;
 	struct hashtable hashtable;
 };
 
 void strings_init(struct strings *strs);
+void strings_init_arena(struct strings *strs, struct arena *arena);
 void strings_clean(struct strings *strs);
+void strings_reserve(struct strings *strs, uint count, uint size);
 
 uint strings_add(struct strings *strs, const char *s);
+uint strings_add_len(struct strings *strs, const char *s, size_t len);
 uint strings_get_id(const struct strings *strs, const char *s);
+uint strings_get_size(const struct strings *strs);
 uint strings_get_first(const struct strings *strs);
 uint strings_get_next(const struct strings *strs, uint i);
 const char *strings_get(const struct strings *strs, uint i);
+uint strings_get_len(const struct strings *strs, uint i);
+
+/* basename lookups, rejected by the filter or found in the filter but not stored */
+struct paths_stats {
+	uint lookups;
+	uint rejected;
+	uint false_positives;
+};
+
+/* file paths stored as pairs of directory and basename ids */
+struct paths {
+	struct strings dirs;
+	struct strings bases;
+	struct array files;
+	struct hashtable hashtable;
+
+	/* bloom filter of basenames with blocks of 64 bits */
+	uint64_t *filter;
+	uint filter_mask;
+	struct paths_stats stats;
+};
+
+void paths_init(struct paths *paths);
+void paths_clean(struct paths *paths);
+int paths_add(struct paths *paths, const char *path, uint value);
+void paths_finalize(struct paths *paths);
+uint paths_get_size(const struct paths *paths);
+uint paths_get_value(const struct paths *paths, uint i);
+uint paths_find_dir(const struct paths *paths, const char *dir);
+uint paths_find_base(struct paths *paths, const char *base);
+uint paths_find(const struct paths *paths, uint dir, uint base);
+
+#define SETS_UNION		0
+#define SETS_INTERSECTION	1
+#define SETS_DIFFERENCE		2
 
 /* array of arrays of sets of integers */
 struct sets {
 	struct array ints;
 	struct array sets_first;
 	struct array sets_size;
-	struct array hashtable;
 	struct array subsets;
+	struct array index_first;
+	struct array index_sets;
+	struct array pending;
+	uint pending_sets;
 };
 
+/* run the statements for each value in the subset */
+#define SETS_FOR_EACH(sets, set, subset, v, ...)				\
+	do {									\
+		uint _first, _last;						\
+										\
+		sets_get_range(sets, set, subset, &_first, &_last);		\
+		ARRAY_FOR_EACH_RANGE(&(sets)->ints, _first, _last - _first, v, __VA_ARGS__); \
+	} while (0)
+
 void sets_init(struct sets *sets);
+void sets_init_arena(struct sets *sets, struct arena *arena);
 void sets_clean(struct sets *sets);
 uint sets_add(struct sets *sets, uint set, uint subset, uint value);
+void sets_append(struct sets *sets, uint set, uint subset, uint value);
+void sets_finalize(struct sets *sets);
+void sets_copy_set(struct sets *dest, uint set, const struct sets *source, uint source_set);
 
 void sets_set_size(struct sets *sets, uint size);
 uint sets_get_size(const struct sets *sets);
 uint sets_get_set_size(const struct sets *sets, uint set);
 uint sets_get_subsets(const struct sets *sets, uint set);
 uint sets_get_subset_size(const struct sets *sets, uint set, uint subset);
+void sets_get_range(const struct sets *sets, uint set, uint subset, uint *start, uint *end);
 uint sets_get(const struct sets *sets, uint set, uint subset, uint index);
 int sets_subset_has(const struct sets *sets, uint set, uint subset, uint value);
 int sets_has(const struct sets *sets, uint set, uint value);
 
-void sets_hash(struct sets *sets);
+void sets_index(struct sets *sets);
+uint sets_find_size(const struct sets *sets, uint value);
+uint sets_find_set(const struct sets *sets, uint value, uint index);
 uint sets_find(const struct sets *sets, uint value, uint *iter);
-void sets_unhash(struct sets *sets);
 
+void sets_combine(struct sets *dest, const struct sets *sets1, const struct sets *sets2, int op);
 void sets_merge(struct sets *dest, const struct sets *source);
-void sets_clone(struct sets *dest, const struct sets *source);
+void sets_transpose(struct sets *dest, const struct sets *source, uint size);
 
 int sets_subsetcmp(const struct sets *sets1, uint set1, uint subset1,
 		const struct sets *sets2, uint set2, uint subset2);
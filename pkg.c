@@ -17,23 +17,39 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "pkg.h"
 
-void pkgs_init(struct pkgs *p) {
-	memset(p, 0, sizeof (struct pkgs));
-	strings_init(&p->strings);
-	array_init(&p->pkgs, sizeof (struct pkg));
-	deps_init(&p->deps, &p->strings);
-	sets_init(&p->requires);
-	sets_init(&p->provides);
-	sets_init(&p->fileprovides);
-	sets_init(&p->required);
-	sets_init(&p->required_by);
-	sets_init(&p->sccs);
-}
-
-void pkgs_clean(struct pkgs *p) {
+/* all tables are allocated in the arena of pkgs */
+static void init_tables(struct pkgs *p) {
+	struct arena *arena = &p->arena;
+
+	strings_init_arena(&p->strings, arena);
+	array_init_arena(&p->pkgs, sizeof (struct pkg), arena);
+	deps_init_arena(&p->deps, &p->strings, arena);
+	sets_init_arena(&p->requires, arena);
+	sets_init_arena(&p->provides, arena);
+	sets_init_arena(&p->fileprovides, arena);
+	sets_init_arena(&p->required, arena);
+	sets_init_arena(&p->required_by, arena);
+	array_init_arena(&p->sccs, 0, arena);
+	array_init_arena(&p->loops, 0, arena);
+	sets_init_arena(&p->scc_pkgs, arena);
+	sets_init_arena(&p->scc_required, arena);
+	sets_init_arena(&p->scc_required_by, arena);
+	sets_init_arena(&p->req_provs, arena);
+	sets_init_arena(&p->prov_reqs, arena);
+	array_init_arena(&p->live_reqby, 0, arena);
+	array_init_arena(&p->live_orreqs, 0, arena);
+	array_init_arena(&p->needed, 0, arena);
+	array_init_arena(&p->dead_reqs, 0, arena);
+	array_init_arena(&p->or_first, 0, arena);
+	array_init_arena(&p->or_live, 0, arena);
+}
+
+static void clean_tables(struct pkgs *p) {
 	strings_clean(&p->strings);
 	array_clean(&p->pkgs);
 	deps_clean(&p->deps);
@@ -42,7 +58,70 @@ void pkgs_clean(struct pkgs *p) {
 	sets_clean(&p->fileprovides);
 	sets_clean(&p->required);
 	sets_clean(&p->required_by);
-	sets_clean(&p->sccs);
+	array_clean(&p->sccs);
+	array_clean(&p->loops);
+	sets_clean(&p->scc_pkgs);
+	sets_clean(&p->scc_required);
+	sets_clean(&p->scc_required_by);
+	sets_clean(&p->req_provs);
+	sets_clean(&p->prov_reqs);
+	array_clean(&p->live_reqby);
+	array_clean(&p->live_orreqs);
+	array_clean(&p->needed);
+	array_clean(&p->dead_reqs);
+	array_clean(&p->or_first);
+	array_clean(&p->or_live);
+}
+
+void pkgs_init(struct pkgs *p) {
+	memset(p, 0, sizeof (struct pkgs));
+	arena_init(&p->arena);
+	init_tables(p);
+}
+
+void pkgs_clean(struct pkgs *p) {
+	clean_tables(p);
+	arena_clean(&p->arena);
+}
+
+/* remove all packages, the memory is kept for the next read */
+void pkgs_reset(struct pkgs *p) {
+	struct arena arena;
+	uint threads;
+
+	clean_tables(p);
+	arena = p->arena;
+	threads = p->threads;
+	memset(p, 0, sizeof (struct pkgs));
+	p->arena = arena;
+	p->threads = threads;
+	arena_reset(&p->arena);
+	init_tables(p);
+}
+
+/* number of threads used in pkgs_match_deps(), zero for all online CPUs */
+void pkgs_set_threads(struct pkgs *p, uint threads) {
+	p->threads = threads;
+}
+
+static uint get_threads(const struct pkgs *p) {
+	long n;
+
+	if (p->threads)
+		return p->threads;
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+/* rough numbers per package used to size the tables before reading */
+#define RESERVE_STRINGS 25
+#define RESERVE_STRING_SIZE 20
+#define RESERVE_DEPS 30
+
+void pkgs_reserve(struct pkgs *p, uint pkgs) {
+	array_reserve(&p->pkgs, pkgs, 0);
+	strings_reserve(&p->strings, pkgs * RESERVE_STRINGS, pkgs * RESERVE_STRINGS * RESERVE_STRING_SIZE);
+	deps_reserve(&p->deps, pkgs * RESERVE_DEPS);
 }
 
 void pkgs_set(struct pkgs *pkgs, uint pid, uint repo, const char *name, int epoch,
@@ -79,35 +158,35 @@ struct pkg *pkgs_getw(struct pkgs *pkgs, uint pid) {
 }
 
 void pkgs_add_req(struct pkgs *p, uint pid, const char *req, int flags, const char *ver) {
-	sets_add(&p->requires, pid, 0, deps_add(&p->deps, req, flags, ver));
+	sets_append(&p->requires, pid, 0, deps_add(&p->deps, req, flags, ver));
 }
 
 void pkgs_add_prov(struct pkgs *p, uint pid, const char *prov, int flags, const char *ver) {
 	/* ignore needless provides */
 	if (strings_get_id(&p->strings, prov) == -1)
 		return;
-	sets_add(&p->provides, pid, 0, deps_add(&p->deps, prov, flags, ver));
+	sets_append(&p->provides, pid, 0, deps_add(&p->deps, prov, flags, ver));
 }
 
 void pkgs_add_req_evr(struct pkgs *p, uint pid, const char *req, int flags,
 		uint epoch, const char *version, const char *release) {
-	sets_add(&p->requires, pid, 0, deps_add_evr(&p->deps, req, flags, epoch, version, release));
+	sets_append(&p->requires, pid, 0, deps_add_evr(&p->deps, req, flags, epoch, version, release));
 }
 
 void pkgs_add_prov_evr(struct pkgs *p, uint pid, const char *prov, int flags,
 		uint epoch, const char *version, const char *release) {
 	if (strings_get_id(&p->strings, prov) == -1)
 		return;
-	sets_add(&p->provides, pid, 0, deps_add_evr(&p->deps, prov, flags, epoch, version, release));
+	sets_append(&p->provides, pid, 0, deps_add_evr(&p->deps, prov, flags, epoch, version, release));
 }
 
-void pkgs_add_fileprov(struct pkgs *p, uint pid, const char *file) {
+void pkgs_add_fileprov(struct pkgs *p, uint pid, uint file) {
 	struct sets *prov;
 
 	/* save fileprovides directly if reading in the same pass as provides */
 	prov = pid + 1 >= sets_get_size(&p->provides) ? &p->provides : &p->fileprovides;
 
-	sets_add(prov, pid, 0, deps_add_evr(&p->deps, file, 0, 0, NULL, NULL));
+	sets_append(prov, pid, 0, deps_add_name(&p->deps, file));
 }
 
 uint pkgs_get_req_size(const struct pkgs *p, uint pid) {
@@ -126,173 +205,353 @@ uint pkgs_get_prov(const struct pkgs *p, uint pid, uint prov) {
 	return sets_get(&p->provides, pid, 0, prov);
 }
 
-uint pkgs_find_req(const struct pkgs *p, uint prov, uint *iter) {
-	uint req, iter2;
-
-	while ((req = deps_find(&p->deps, prov, iter)) != -1) {
-		iter2 = 0;
-		if (sets_find(&p->requires, req, &iter2) != -1)
-			return req;
-	}
+static uint get_resolved(const struct sets *resolved, uint dep, uint what, uint *iter) {
+	if (dep >= sets_get_size(resolved) || what >= sets_get_subsets(resolved, dep) ||
+			*iter >= sets_get_subset_size(resolved, dep, what))
+		return -1;
+	return sets_get(resolved, dep, what, (*iter)++);
+}
 
-	return req;
+uint pkgs_find_req(const struct pkgs *p, uint prov, uint *iter) {
+	return get_resolved(&p->prov_reqs, prov, RESOLVED_DEPS, iter);
 }
 
 uint pkgs_find_prov(const struct pkgs *p, uint req, uint *iter) {
-	uint prov, iter2;
+	return get_resolved(&p->req_provs, req, RESOLVED_DEPS, iter);
+}
 
-	while ((prov = deps_find(&p->deps, req, iter)) != -1) {
-		iter2 = 0;
-		if (sets_find(&p->provides, prov, &iter2) != -1)
-			return prov;
-	}
+static inline int pkg_live(const struct pkgs *p, uint pid) {
+	return !(pkgs_get(p, pid)->status & PKG_ALLDEL);
+}
 
-	return prov;
+static inline uint or_dep(const struct pkgs *p, uint pid, uint subset) {
+	return array_get(&p->or_first, pid) + subset - 1;
 }
 
 static int pkg_req_pkg(const struct pkgs *p, uint pid, uint what) {
-	uint i, j, n, subs;
+	uint i, subs;
 
 	subs = sets_get_subsets(&p->required, pid);
 
 	for (i = 1; i < subs; i++) {
 		if (!sets_subset_has(&p->required, pid, i, what))
 			continue;
-		n = sets_get_subset_size(&p->required, pid, i);
-		for (j = 0; j < n; j++) {
-			uint req = sets_get(&p->required, pid, i, j);
-			if (req != what && !(pkgs_get(p, req)->status & PKG_ALLDEL))
-				break;
-		}
-		if (j == n)
+		if (array_get(&p->or_live, or_dep(p, pid, i)) == pkg_live(p, what))
 			return 1;
 	}
 	return 0;
 }
 
 static int leaf_pkg(struct pkgs *p, uint pid) {
-	uint i, n;
-	uint partleaf;
-	
 	if (pkgs_get(p, pid)->status & PKG_DELETED)
 		return 0;
 
-	n = sets_get_subset_size(&p->required_by, pid, 0);
+	if (array_get(&p->live_reqby, pid) || array_get(&p->needed, pid))
+		return 0;
+
+	return array_get(&p->live_orreqs, pid) ? PKG_PARTLEAF : PKG_LEAF;
+}
 
-	for (i = 0; i < n; i++)
-		if (!(pkgs_get(p, sets_get(&p->required_by, pid, 0, i))->status & PKG_ALLDEL))
-			return 0;
+static int broken_pkg(struct pkgs *p, uint pid) {
+	return array_get(&p->dead_reqs, pid) != 0;
+}
 
-	if (sets_get_subsets(&p->required_by, pid) <= 1)
-		return PKG_LEAF;
+/* count live packages in required and required_by */
+static void init_counters(struct pkgs *p) {
+	uint i, j, n, subs, live, ors, or;
 
-	n = sets_get_subset_size(&p->required_by, pid, 1);
+	n = pkgs_get_size(p);
+
+	array_set_size(&p->live_reqby, n);
+	array_set_size(&p->live_orreqs, n);
+	array_set_size(&p->needed, n);
+	array_set_size(&p->dead_reqs, n);
+	array_set_size(&p->or_first, n);
+
+	for (i = ors = 0; i < n; i++) {
+		array_set(&p->or_first, i, ors);
+		ors += sets_get_subsets(&p->required, i) - 1;
+	}
+	array_set_size(&p->or_live, ors);
 
-	partleaf = 0;
 	for (i = 0; i < n; i++) {
-		uint r = sets_get(&p->required_by, pid, 1, i);
-		if (!(pkgs_get(p, r)->status & PKG_ALLDEL)) {
-		       	if (pkg_req_pkg(p, r, pid))
-				return 0;
-			partleaf = 1;
+		live = pkg_live(p, i);
+		SETS_FOR_EACH(&p->required, i, 0, r,
+			if (live)
+				array_inc(&p->live_reqby, r, 1);
+			if (!pkg_live(p, r))
+				array_inc(&p->dead_reqs, i, 1);
+		);
+
+		subs = sets_get_subsets(&p->required, i);
+		for (j = 1; j < subs; j++) {
+			or = or_dep(p, i, j);
+			SETS_FOR_EACH(&p->required, i, j, r,
+				if (pkg_live(p, r))
+					array_inc(&p->or_live, or, 1);
+			);
+			if (!array_get(&p->or_live, or))
+				array_inc(&p->dead_reqs, i, 1);
+			if (!live)
+				continue;
+			SETS_FOR_EACH(&p->required, i, j, r,
+				array_inc(&p->live_orreqs, r, 1);
+				if (array_get(&p->or_live, or) == pkg_live(p, r))
+					array_inc(&p->needed, r, 1);
+			);
 		}
 	}
-	return partleaf ? PKG_PARTLEAF : PKG_LEAF;
 }
 
-static int broken_pkg(struct pkgs *p, uint pid) {
-	uint i, j, n, subs;
+/* update the counters when pid is deleted (inc -1) or undeleted (inc 1) */
+static void update_counters(struct pkgs *p, uint pid, int inc) {
+	uint i, subs, or, old, new, live;
+
+	/* pid as a requirer */
+	SETS_FOR_EACH(&p->required, pid, 0, r,
+		array_inc(&p->live_reqby, r, inc);
+	);
 
-	n = sets_get_subset_size(&p->required, pid, 0);
-	for (i = 0; i < n; i++)
-		if (pkgs_get(p, sets_get(&p->required, pid, 0, i))->status & PKG_ALLDEL)
-			return 1;
-	
 	subs = sets_get_subsets(&p->required, pid);
 	for (i = 1; i < subs; i++) {
-		n = sets_get_subset_size(&p->required, pid, i);
-		for (j = 0; j < n; j++)
-			if (!(pkgs_get(p, sets_get(&p->required, pid, i, j))->status & PKG_ALLDEL))
-				break;
-		if (j == n)
-			return 1;
+		or = or_dep(p, pid, i);
+		SETS_FOR_EACH(&p->required, pid, i, r,
+			array_inc(&p->live_orreqs, r, inc);
+			if (array_get(&p->or_live, or) == pkg_live(p, r))
+				array_inc(&p->needed, r, inc);
+		);
 	}
 
-	return 0;
+	/* pid as a required package, the OR deps of requirers are searched */
+	SETS_FOR_EACH(&p->required_by, pid, 0, r,
+		array_inc(&p->dead_reqs, r, -inc);
+	);
+
+	if (sets_get_subsets(&p->required_by, pid) <= 1)
+		return;
+
+	SETS_FOR_EACH(&p->required_by, pid, 1, r,
+		live = pkg_live(p, r);
+		subs = sets_get_subsets(&p->required, r);
+		for (i = 1; i < subs; i++) {
+			if (!sets_subset_has(&p->required, r, i, pid))
+				continue;
+			or = or_dep(p, r, i);
+			old = array_get(&p->or_live, or);
+			new = old + inc;
+			array_set(&p->or_live, or, new);
+			if (!old || !new)
+				array_inc(&p->dead_reqs, r, new ? -1 : 1);
+			if (!live)
+				continue;
+			/* the count of other live packages changed for all except pid */
+			SETS_FOR_EACH(&p->required, r, i, m,
+				if (m == pid)
+					continue;
+				if (old == pkg_live(p, m))
+					array_inc(&p->needed, m, -1);
+				if (new == pkg_live(p, m))
+					array_inc(&p->needed, m, 1);
+			);
+		}
+	);
 }
 
-static void fill_required(struct pkgs *p, uint pid) {
-	uint i, j, s, c, req, reqs, pr, prov, requires;
-	struct sets set;
+/* set or clear PKG_DELETE and update the counters if the package was live */
+static void set_delete(struct pkgs *p, uint pid, int delete) {
+	struct pkg *pkg = pkgs_getw(p, pid);
+	int live = pkg_live(p, pid);
 
-	requires = pkgs_get_req_size(p, pid);
+	if (delete)
+		pkg->status |= PKG_DELETE;
+	else
+		pkg->status &= ~PKG_DELETE;
 
-	sets_init(&set);
-	/* force allocating subsets */
-	sets_add(&set, 0, requires, 0);
+	if (live != pkg_live(p, pid))
+		update_counters(p, pid, live ? -1 : 1);
+}
 
-	for (i = 0; i < requires; i++) {
-		uint iter1 = 0;
+/* find matching provides and their packages for all required deps */
+static void resolve_deps(struct pkgs *p) {
+	uint i, n, dep, prov, iter, first, provs;
+	struct array matches;
 
-		req = pkgs_get_req(p, pid, i);
+	n = deps_get_size(&p->deps);
+	array_init(&matches, 0);
 
-		while ((pr = deps_find(&p->deps, req, &iter1)) != -1) {
-			uint iter2 = 0;
+	for (dep = 0; dep < n; dep++) {
+		if (!sets_find_size(&p->requires, dep))
+			continue;
 
-			while ((prov = sets_find(&p->provides, pr, &iter2)) != -1) {
-				sets_add(&set, 0, i, prov);
-				if (prov == pid)
-					break;
-			}
+		iter = 0;
+		for (provs = 0; (prov = deps_find_prov(&p->deps, dep, &iter)) != -1; provs++) {
+			array_set(&matches, provs, prov);
+			sets_append(&p->req_provs, dep, RESOLVED_DEPS, prov);
+			sets_append(&p->prov_reqs, prov, RESOLVED_DEPS, dep);
+			for (i = 0; i < sets_find_size(&p->provides, prov); i++)
+				sets_append(&p->req_provs, dep, RESOLVED_PKGS,
+						sets_find_set(&p->provides, prov, i));
 		}
+
+		for (first = 0; first < sets_find_size(&p->requires, dep); first++)
+			for (i = 0; i < provs; i++)
+				sets_append(&p->prov_reqs, array_get(&matches, i), RESOLVED_PKGS,
+						sets_find_set(&p->requires, dep, first));
+	}
+	array_clean(&matches);
+
+	sets_finalize(&p->req_provs);
+	sets_finalize(&p->prov_reqs);
+	sets_set_size(&p->req_provs, n);
+	sets_set_size(&p->prov_reqs, n);
+}
+
+/*
+ * Passes over all packages are run in threads. Each thread takes chunks of
+ * pids and fills sets of its own, which are copied to the final sets in
+ * order of pids when all threads are finished.
+ */
+
+#define PASS_CHUNK 64
+
+struct pass;
+
+struct pass_worker {
+	struct pass *pass;
+	struct sets sets;
+	uint sets_size;
+	pthread_t thread;
+};
+
+struct pass {
+	struct pkgs *p;
+	void (*func)(struct pass *pass, struct sets *out, uint set, uint pid);
+	uint size;
+	uint next;
+	uint *chunk_workers;
+	uint *chunk_sets;
+	struct pass_worker *workers;
+};
+
+static void *pass_run(void *arg) {
+	struct pass_worker *w = arg;
+	struct pass *pass = w->pass;
+	uint start, end, chunk, pid;
+
+	while ((start = __atomic_fetch_add(&pass->next, PASS_CHUNK, __ATOMIC_RELAXED)) < pass->size) {
+		end = MIN(start + PASS_CHUNK, pass->size);
+		chunk = start / PASS_CHUNK;
+		pass->chunk_workers[chunk] = w - pass->workers;
+		pass->chunk_sets[chunk] = w->sets_size;
+		for (pid = start; pid < end; pid++)
+			pass->func(pass, &w->sets, w->sets_size++, pid);
+	}
+
+	return NULL;
+}
+
+/* call func for all pids, the sets it fills are copied to dest */
+static void run_pass(struct pkgs *p, void (*func)(struct pass *pass, struct sets *out, uint set, uint pid),
+		struct sets *dest) {
+	struct pass pass;
+	struct pass_worker *w;
+	uint i, pid, chunks, threads, started;
+
+	pass.p = p;
+	pass.func = func;
+	pass.size = pkgs_get_size(p);
+	pass.next = 0;
+
+	chunks = (pass.size + PASS_CHUNK - 1) / PASS_CHUNK;
+	threads = MAX(MIN(get_threads(p), chunks), 1);
+
+	pass.chunk_workers = malloc(chunks * sizeof (uint));
+	pass.chunk_sets = malloc(chunks * sizeof (uint));
+	pass.workers = malloc(threads * sizeof (struct pass_worker));
+
+	for (i = 0; i < threads; i++) {
+		w = &pass.workers[i];
+		w->pass = &pass;
+		sets_init(&w->sets);
+		w->sets_size = 0;
+	}
+
+	/* the calling thread is the first worker */
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&pass.workers[started].thread, NULL, pass_run,
+					&pass.workers[started]))
+			break;
+	pass_run(&pass.workers[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(pass.workers[i].thread, NULL);
+
+	for (pid = 0; pid < pass.size; pid++) {
+		i = pid / PASS_CHUNK;
+		w = &pass.workers[pass.chunk_workers[i]];
+		sets_copy_set(dest, pid, &w->sets, pass.chunk_sets[i] + pid % PASS_CHUNK);
 	}
+	sets_set_size(dest, pass.size);
+
+	for (i = 0; i < threads; i++)
+		sets_clean(&pass.workers[i].sets);
+	free(pass.workers);
+	free(pass.chunk_sets);
+	free(pass.chunk_workers);
+}
+
+/* add required packages of pid to the set, OR deps are in separate subsets */
+static void fill_required(struct pass *pass, struct sets *out, uint set, uint pid) {
+	struct pkgs *p = pass->p;
+	uint i, j, s, c, req, reqs, requires;
+	const struct sets *rp = &p->req_provs;
+
+	requires = pkgs_get_req_size(p, pid);
 
 	for (i = reqs = 0; i < requires; i++) {
-		if (sets_subset_has(&set, 0, i, pid))
+		req = pkgs_get_req(p, pid, i);
+		if (sets_subset_has(rp, req, RESOLVED_PKGS, pid))
 			/* ignore self dependency */
 			continue;
-		s = sets_get_subset_size(&set, 0, i);
+		s = sets_get_subset_size(rp, req, RESOLVED_PKGS);
 		if (s == 1) {
-			sets_add(&p->required, pid, 0, sets_get(&set, 0, i, 0));
+			sets_add(out, set, 0, sets_get(rp, req, RESOLVED_PKGS, 0));
 			reqs++;
 		} else if (!s)
 			pkgs_getw(p, pid)->status |= PKG_BROKEN;
 	}
 
 	for (i = 0, c = 1; i < requires; i++) {
-		if (sets_subset_has(&set, 0, i, pid))
+		req = pkgs_get_req(p, pid, i);
+		if (sets_subset_has(rp, req, RESOLVED_PKGS, pid))
 			continue;
-		s = sets_get_subset_size(&set, 0, i);
+		s = sets_get_subset_size(rp, req, RESOLVED_PKGS);
 		if (s > 1) {
 			for (j = 0; j < s; j++)
-				if (reqs && sets_subset_has(&p->required, pid, 0, sets_get(&set, 0, i, j)))
+				if (reqs && sets_subset_has(out, set, 0,
+							sets_get(rp, req, RESOLVED_PKGS, j)))
 					/* contains already required package */
 					goto continue2;
 			for (j = 1; j < c; j++)
-				if (!sets_subsetcmp(&p->required, pid, j, &set, 0, i))
+				if (!sets_subsetcmp(out, set, j, rp, req, RESOLVED_PKGS))
 					/* duplicate */
 					goto continue2;
 			for (j = 0; j < s; j++)
-				sets_add(&p->required, pid, c, sets_get(&set, 0, i, j));
+				sets_add(out, set, c, sets_get(rp, req, RESOLVED_PKGS, j));
 			c++;
 		}
 continue2:
 		;
 	}
-	sets_clean(&set);
 }
 
-static void fill_required_by(struct pkgs *p, uint pid) {
-	uint i, iter = 0;
-
-	while ((i = sets_find(&p->required, pid, &iter)) != -1)
-		if (sets_subset_has(&p->required, i, 0, pid))
-			sets_add(&p->required_by, pid, 0, i);
-		else
-			sets_add(&p->required_by, pid, 1, i);
-}
+/* Tarjan's SCC algorithm with explicit stack of visited packages */
 
-/* Tarjan's SCC algorithm */
+struct tarjan_frame {
+	uint pid;
+	uint subset;
+	uint pos;
+	uint end;
+};
 
 struct tarjan {
 	struct pkgs *pkgs;
@@ -300,54 +559,92 @@ struct tarjan {
 	struct array lowlink;
 	struct array stack;
 	struct array onstack;
+	struct array frames;
 	uint counter;
+	uint sccs;
+	uint loops;
 };
 
-static void find_scc_rec(struct tarjan *t, uint pid) {
-	uint i, s, subset, subsets, r;
+static void tarjan_visit(struct tarjan *t, uint pid) {
+	const struct sets *reqby = &t->pkgs->required_by;
+	struct tarjan_frame *f;
 
 	array_set(&t->index, pid, ++t->counter);
 	array_set(&t->lowlink, pid, t->counter);
 	array_set(&t->stack, array_get_size(&t->stack), pid);
 	array_set(&t->onstack, pid, 1);
 
-	subsets = sets_get_subsets(&t->pkgs->required_by, pid);
-	for (subset = 0; subset < subsets; subset++) {
-		s = sets_get_subset_size(&t->pkgs->required_by, pid, subset);
-		for (i = 0; i < s; i++) {
-			r = sets_get(&t->pkgs->required_by, pid, subset, i);
-
-			if (!array_get(&t->index, r)) {
-				find_scc_rec(t, r);
-				array_set(&t->lowlink, pid, MIN(array_get(&t->lowlink, pid), 
-							array_get(&t->lowlink, r)));
-			} else if (array_get(&t->onstack, r))
-				array_set(&t->lowlink, pid, MIN(array_get(&t->lowlink, pid),
-							array_get(&t->index, r)));
+	f = ASGETWPTR(tarjan_frame, &t->frames, array_get_size(&t->frames));
+	f->pid = pid;
+	f->subset = 0;
+	sets_get_range(reqby, pid, 0, &f->pos, &f->end);
+}
+
+static void tarjan_finish(struct tarjan *t, uint pid) {
+	uint i, j, s, r, scc, loop;
+
+	if (array_get(&t->lowlink, pid) != array_get(&t->index, pid))
+		return;
+
+	s = j = array_get_size(&t->stack);
+	while (array_get(&t->stack, --j) != pid)
+		;
+
+	loop = s - j > 1 ? t->loops++ : -1;
+
+	for (i = j, scc = t->sccs++; i < s; i++) {
+		r = array_get(&t->stack, i);
+		if (loop != -1) {
+			pkgs_getw(t->pkgs, r)->status |= PKG_INLOOP;
+			array_set(&t->pkgs->loops, r, loop);
 		}
+		array_set(&t->pkgs->sccs, r, scc);
+		sets_append(&t->pkgs->scc_pkgs, scc, 0, r);
+		array_set(&t->onstack, r, 0);
 	}
+	array_set_size(&t->stack, j);
+}
 
-	if (array_get(&t->lowlink, pid) == array_get(&t->index, pid)) {
-		uint j, scc;
+static void find_scc(struct tarjan *t, uint root) {
+	const struct sets *reqby = &t->pkgs->required_by;
+	struct tarjan_frame *f;
+	uint pid, r, n;
 
-		s = j = array_get_size(&t->stack);
-		while (array_get(&t->stack, --j) != pid)
-			;
+	tarjan_visit(t, root);
 
-		for (i = j, scc = sets_get_size(&t->pkgs->sccs); i < s; i++) {
-			r = array_get(&t->stack, i);
-			if (s - j > 1) {
-				pkgs_getw(t->pkgs, r)->status |= PKG_INLOOP;
-				sets_add(&t->pkgs->sccs, scc, 0, r);
-			}
-			array_set(&t->onstack, r, 0);
+	while ((n = array_get_size(&t->frames))) {
+		f = ASGETWPTR(tarjan_frame, &t->frames, n - 1);
+		pid = f->pid;
+
+		if (f->pos == f->end && f->subset + 1 < sets_get_subsets(reqby, pid)) {
+			sets_get_range(reqby, pid, ++f->subset, &f->pos, &f->end);
+			continue;
+		}
+
+		if (f->pos < f->end) {
+			r = array_get(&reqby->ints, f->pos++);
+			if (!array_get(&t->index, r))
+				tarjan_visit(t, r);
+			else if (array_get(&t->onstack, r))
+				array_set(&t->lowlink, pid, MIN(array_get(&t->lowlink, pid),
+							array_get(&t->index, r)));
+			continue;
+		}
+
+		array_set_size(&t->frames, n - 1);
+		tarjan_finish(t, pid);
+
+		if (n > 1) {
+			r = ASGETPTR(tarjan_frame, &t->frames, n - 2)->pid;
+			array_set(&t->lowlink, r, MIN(array_get(&t->lowlink, r),
+						array_get(&t->lowlink, pid)));
 		}
-		array_set_size(&t->stack, j);
 	}
 }
 
+/* the components are found in reverse topological order of required_by */
 static void find_sccs(struct pkgs *p) {
-	uint i, n;
+	uint i, j, n, scc, subs;
 	struct tarjan t;
 
 	n = pkgs_get_size(p);
@@ -360,18 +657,40 @@ static void find_sccs(struct pkgs *p) {
 	array_init(&t.stack, 0);
 	array_init(&t.onstack, 0);
 	array_set_size(&t.onstack, n);
+	array_init(&t.frames, sizeof (struct tarjan_frame));
 	t.counter = 0;
+	t.sccs = 0;
+	t.loops = 0;
+
+	array_reserve(&p->sccs, n, n);
+	array_set_size(&p->loops, n);
 
 	for (i = 0; i < n; i++)
 		if (!array_get(&t.index, i))
-			find_scc_rec(&t, i);
+			find_scc(&t, i);
 
+	array_clean(&t.frames);
 	array_clean(&t.onstack);
 	array_clean(&t.stack);
 	array_clean(&t.lowlink);
 	array_clean(&t.index);
 
-	sets_hash(&p->sccs);
+	sets_finalize(&p->scc_pkgs);
+	sets_set_size(&p->scc_pkgs, t.sccs);
+
+	/* condensation of required, edges within components are dropped */
+	for (i = 0; i < n; i++) {
+		scc = array_get(&p->sccs, i);
+		subs = sets_get_subsets(&p->required, i);
+		for (j = 0; j < subs; j++)
+			SETS_FOR_EACH(&p->required, i, j, r,
+				if (array_get(&p->sccs, r) != scc)
+					sets_append(&p->scc_required, scc, 0, array_get(&p->sccs, r));
+			);
+	}
+	sets_finalize(&p->scc_required);
+	sets_set_size(&p->scc_required, t.sccs);
+	sets_transpose(&p->scc_required_by, &p->scc_required, t.sccs);
 }
 
 void pkgs_match_deps(struct pkgs *p) {
@@ -379,6 +698,10 @@ void pkgs_match_deps(struct pkgs *p) {
 
 	n = pkgs_get_size(p);
 
+	sets_finalize(&p->requires);
+	sets_finalize(&p->provides);
+	sets_finalize(&p->fileprovides);
+
 	if (sets_get_size(&p->fileprovides))
 		sets_merge(&p->provides, &p->fileprovides);
 	sets_clean(&p->fileprovides);
@@ -386,56 +709,53 @@ void pkgs_match_deps(struct pkgs *p) {
 	sets_set_size(&p->requires, n);
 	sets_set_size(&p->provides, n);
 
-	sets_hash(&p->provides);
-	sets_hash(&p->requires);
+	sets_index(&p->provides);
+	sets_index(&p->requires);
+	deps_index_provs(&p->deps, &p->provides);
+	resolve_deps(p);
 
-	for (i = 0; i < n; i++)
-		fill_required(p, i);
-	sets_set_size(&p->required, n);
+	run_pass(p, fill_required, &p->required);
 
-	sets_hash(&p->required);
+	/* packages with OR deps are in subset 1 */
+	sets_transpose(&p->required_by, &p->required, n);
 
-	for (i = 0; i < n; i++)
-		fill_required_by(p, i);
-	sets_set_size(&p->required_by, n);
-
-	sets_unhash(&p->required);
+	init_counters(p);
 
+	/* leaf_pkg() only reads the counters, a serial loop is fast enough */
 	for (i = 0; i < n; i++)
 		pkgs_getw(p, i)->status |= leaf_pkg(p, i);
 
 	find_sccs(p);
 }
 
+/* number of the loop with the package, -1 if not in a loop */
 uint pkgs_get_scc(const struct pkgs *p, uint pid) {
-	uint iter = 0;
-
-	return pkgs_get(p, pid)->status & PKG_INLOOP ? sets_find(&p->sccs, pid, &iter) : -1;
+	return pkgs_get(p, pid)->status & PKG_INLOOP ? array_get(&p->loops, pid) : -1;
 }
 
 int pkgs_in_scc(const struct pkgs *p, uint scc, uint pid) {
-	return sets_has(&p->sccs, scc, pid);
+	return pkgs_get_scc(p, pid) == scc;
 }
 
-static void verify_partleaves(struct pkgs *p, uint pid, uint what, int removed) {
-	uint i, j, n, subs;
-	struct pkg *pkg;
+static void update_leaf(struct pkgs *p, uint pid) {
+	struct pkg *pkg = pkgs_getw(p, pid);
+
+	pkg->status &= ~(PKG_LEAF | PKG_PARTLEAF);
+	pkg->status |= leaf_pkg(p, pid);
+}
+
+/* update leaves among the alternatives of what in OR deps of pid */
+static void verify_partleaves(struct pkgs *p, uint pid, uint what) {
+	uint i, subs;
 
 	subs = sets_get_subsets(&p->required, pid);
 
 	for (i = 1; i < subs; i++) {
 		if (!sets_subset_has(&p->required, pid, i, what))
 			continue;
-		n = sets_get_subset_size(&p->required, pid, i);
-		for (j = 0; j < n; j++) {
-			uint r = sets_get(&p->required, pid, i, j);
-
-			pkg = pkgs_getw(p, r);
-			if (removed && pkg->status & PKG_PARTLEAF && !leaf_pkg(p, r))
-				pkg->status &= ~PKG_PARTLEAF;
-			if (!removed && !(pkg->status & (PKG_LEAF | PKG_PARTLEAF)) && leaf_pkg(p, r))
-				pkg->status |= PKG_PARTLEAF;
-		}
+		SETS_FOR_EACH(&p->required, pid, i, r,
+			update_leaf(p, r);
+		);
 	}
 }
 
@@ -458,213 +778,217 @@ static void unbreak_pkg(struct pkgs *p, uint pid) {
 	}
 }
 
-int pkgs_delete(struct pkgs *p, uint pid, int force) {
-	uint i, j, n, r, subs;
-	struct pkg *pkg, *pkg1;
-
-	pkg = pkgs_getw(p, pid);
-	if (pkg->status & PKG_ALLDEL)
-		return 0;
-
-	if (!force && !(pkg->status & (PKG_LEAF | PKG_PARTLEAF)))
-		return 0;
-
-	pkg->status |= PKG_DELETE;
-	p->delete_pkgs++;
-	p->delete_pkgs_kbytes += pkg->size;
-	unbreak_pkg(p, pid);
+/*
+ * Update the totals and the leaf and broken statuses after the packages
+ * were deleted or undeleted with set_delete(), the counters are already
+ * updated so the order of the packages doesn't matter.
+ */
+static void update_deleted(struct pkgs *p, const uint *pids, uint n, int delete) {
+	uint i, j, pid, subs;
+	struct pkg *pkg;
 
-	/* check if there are new leaves */
-	subs = sets_get_subsets(&p->required, pid);
-	for (i = 0; i < subs; i++) {
-		n = sets_get_subset_size(&p->required, pid, i);
-		for (j = 0; j < n; j++) {
-			r = sets_get(&p->required, pid, i, j); 
-			pkg1 = pkgs_getw(p, r);
-			pkg1->status &= ~(PKG_LEAF | PKG_PARTLEAF);
-			pkg1->status |= leaf_pkg(p, r);
+	for (i = 0; i < n; i++) {
+		pid = pids[i];
+		pkg = pkgs_getw(p, pid);
+		if (delete) {
+			p->delete_pkgs++;
+			p->delete_pkgs_kbytes += pkg->size;
+			unbreak_pkg(p, pid);
+		} else {
+			p->delete_pkgs--;
+			p->delete_pkgs_kbytes -= pkg->size;
+			if (broken_pkg(p, pid))
+				break_pkg(p, pid);
 		}
 	}
 
-	subs = sets_get_subsets(&p->required_by, pid);
-	if (pkg->status & PKG_PARTLEAF || !(pkg->status & PKG_LEAF)) {
-		/* check if there are new broken packages or lost leaves */
-		for (i = 0; i < subs; i++) {
-			n = sets_get_subset_size(&p->required_by, pid, i);
-			for (j = 0; j < n; j++) {
-				r = sets_get(&p->required_by, pid, i, j); 
-
-				if (pkgs_get(p, r)->status & PKG_ALLDEL)
-				       continue;
-				if (broken_pkg(p, r))
+	for (i = 0; i < n; i++) {
+		pid = pids[i];
+
+		/* check if there are new or lost leaves */
+		subs = sets_get_subsets(&p->required, pid);
+		for (j = 0; j < subs; j++)
+			SETS_FOR_EACH(&p->required, pid, j, r,
+				update_leaf(p, r);
+			);
+
+		/* check if there are new or unbroken broken packages */
+		subs = sets_get_subsets(&p->required_by, pid);
+		for (j = 0; j < subs; j++) {
+			SETS_FOR_EACH(&p->required_by, pid, j, r,
+				if (!pkg_live(p, r))
+					continue;
+				if (delete && broken_pkg(p, r))
 					break_pkg(p, r);
-				if (i)
-					verify_partleaves(p, r, pid, 1);
-			}
+				if (!delete && !broken_pkg(p, r))
+					unbreak_pkg(p, r);
+				if (j)
+					verify_partleaves(p, r, pid);
+			);
 		}
 	}
-
-	return 1;
 }
 
-int pkgs_undelete(struct pkgs *p, uint pid, int force) {
-	uint i, j, n, r, subs;
-	struct pkg *pkg;
+int pkgs_delete(struct pkgs *p, uint pid, int force) {
+	const struct pkg *pkg;
 
-	pkg = pkgs_getw(p, pid);
-	if (!(pkg->status & PKG_DELETE))
+	pkg = pkgs_get(p, pid);
+	if (pkg->status & PKG_ALLDEL)
 		return 0;
 
-	pkg->status &= ~PKG_DELETE;
+	if (!force && !(pkg->status & (PKG_LEAF | PKG_PARTLEAF)))
+		return 0;
 
-	if (broken_pkg(p, pid)) {
-		if (!force) {
-			pkg->status |= PKG_DELETE;
-			return 0;
-		}
-		break_pkg(p, pid);
-	}
+	set_delete(p, pid, 1);
+	update_deleted(p, &pid, 1, 1);
 
-	p->delete_pkgs--;
-	p->delete_pkgs_kbytes -= pkg->size;
+	return 1;
+}
 
-	/* check if we lost some leaves */
-	subs = sets_get_subsets(&p->required, pid);
-	for (i = 0; i < subs; i++) {
-		n = sets_get_subset_size(&p->required, pid, i);
-		for (j = 0; j < n; j++) {
-			r = sets_get(&p->required, pid, i, j); 
-
-			pkg = pkgs_getw(p, r);
-			pkg->status &= ~(PKG_LEAF | PKG_PARTLEAF);
-			if (i)
-				pkg->status |= leaf_pkg(p, r);
-		}
-	}
+int pkgs_undelete(struct pkgs *p, uint pid, int force) {
+	const struct pkg *pkg;
 
-	/* check if we unbroke some packages or made new leaves */
-	subs = sets_get_subsets(&p->required_by, pid);
-	for (i = 0; i < subs; i++) {
-		n = sets_get_subset_size(&p->required_by, pid, i);
-		for (j = 0; j < n; j++) {
-			uint s;
+	pkg = pkgs_get(p, pid);
+	if (!(pkg->status & PKG_DELETE))
+		return 0;
 
-			r = sets_get(&p->required_by, pid, i, j); 
-			s = pkgs_get(p, r)->status;
+	if (!force && broken_pkg(p, pid))
+		return 0;
 
-			if (s & PKG_ALLDEL)
-				continue;
-			if (s & PKG_TOBEBROKEN && !broken_pkg(p, r))
-				unbreak_pkg(p, r);
-			if (i)
-				verify_partleaves(p, r, pid, 0);
-		}
-	}
+	set_delete(p, pid, 0);
+	update_deleted(p, &pid, 1, 0);
 
 	return 1;
 }
 
+/*
+ * Delete pid and all packages which need it, directly or over other
+ * deleted packages. The packages are deleted as they are queued, so each
+ * is queued only once and the OR deps of the later ones see all deletions
+ * made so far.
+ */
 int pkgs_delete_rec(struct pkgs *p, uint pid) {
-	uint i = 0, j, req, s;
-	const struct sets *r;
-	const struct pkg *pkg;
+	uint i, n, first, *queue;
 
-	r = &p->required_by;
-	pkg = pkgs_get(p, pid);
+	queue = malloc(pkgs_get_size(p) * sizeof (uint));
 
-	if (!(pkg->status & PKG_ALLDEL) && pkg->status & PKG_INLOOP &&
-			!pkgs_delete(p, pid, 1))
-		return 0;
+	/* requirers of an already deleted package are deleted too */
+	first = !pkg_live(p, pid);
+	if (!first)
+		set_delete(p, pid, 1);
+	queue[0] = pid;
 
-	for (i = 0; i < sets_get_subsets(r, pid); i++) {
-		s = sets_get_subset_size(r, pid, i);
-		for (j = 0; j < s; j++) {
-			req = sets_get(r, pid, i, j);
-			if (pkgs_get(p, req)->status & PKG_ALLDEL)
+	for (i = 0, n = 1; i < n; i++) {
+		pid = queue[i];
+		SETS_FOR_EACH(&p->required_by, pid, 0, r,
+			if (!pkg_live(p, r))
 				continue;
-			if (i && !pkg_req_pkg(p, req, pid))
+			set_delete(p, r, 1);
+			queue[n++] = r;
+		);
+		if (sets_get_subsets(&p->required_by, pid) <= 1)
+			continue;
+		SETS_FOR_EACH(&p->required_by, pid, 1, r,
+			if (!pkg_live(p, r) || !pkg_req_pkg(p, r, pid))
 				continue;
-			if (!pkgs_delete_rec(p, req))
-				return 0;
-		}
+			set_delete(p, r, 1);
+			queue[n++] = r;
+		);
 	}
 
-	if (!(pkg->status & PKG_DELETE) && !pkgs_delete(p, pid, 0))
-		return 0;
+	update_deleted(p, queue + first, n - first, 1);
+	pid = queue[0];
+	free(queue);
 
-	return 1;
+	return (pkgs_get(p, pid)->status & PKG_DELETE) != 0;
 }
 
+/* undelete pid and all deleted packages it requires directly or over them */
 int pkgs_undelete_rec(struct pkgs *p, uint pid) {
-	uint i = 0, j, req, s;
-	const struct sets *r;
-	const struct pkg *pkg;
-
-	r = &p->required;
-	pkg = pkgs_get(p, pid);
-
-	if (pkg->status & PKG_ALLDEL && pkg->status & PKG_INLOOP &&
-			!pkgs_undelete(p, pid, 1))
-		return 0;
-
-	for (i = 0; i < 1 && i < sets_get_subsets(r, pid); i++) {
-		s = sets_get_subset_size(r, pid, i);
-		for (j = 0; j < s; j++) {
-			req = sets_get(r, pid, i, j);
-			if (!(pkgs_get(p, req)->status & PKG_ALLDEL))
+	uint i, n, first, *queue;
+	int ret = 1;
+
+	queue = malloc(pkgs_get_size(p) * sizeof (uint));
+
+	first = !(pkgs_get(p, pid)->status & PKG_DELETE);
+	if (!first)
+		set_delete(p, pid, 0);
+	else if (!pkg_live(p, pid))
+		ret = 0;
+	queue[0] = pid;
+
+	for (i = 0, n = 1; i < n; i++) {
+		SETS_FOR_EACH(&p->required, queue[i], 0, r,
+			if (!(pkgs_get(p, r)->status & PKG_DELETE)) {
+				if (!pkg_live(p, r))
+					ret = 0;
 				continue;
-			if (!pkgs_undelete_rec(p, req))
-				return 0;
-		}
+			}
+			set_delete(p, r, 0);
+			queue[n++] = r;
+		);
 	}
 
-	if (pkg->status & PKG_ALLDEL && !pkgs_undelete(p, pid, 1))
-		return 0;
+	update_deleted(p, queue + first, n - first, 0);
+	free(queue);
 
-	return 1;
+	return ret;
 }
 
-void pkgs_get_trans_reqs(const struct pkgs *p, uint pid, int reqby, struct sets *set) {
-	uint i, j, req, s;
-	const struct sets *r;
+static void add_scc_pkgs(const struct pkgs *p, uint scc, struct sets *set) {
+	SETS_FOR_EACH(&p->scc_pkgs, scc, 0, pid,
+		sets_append(set, 0, 0, pid);
+	);
+}
 
-	r = reqby ? &p->required_by : &p->required;
+/* walk the condensation, all packages in a reached component are reached */
+void pkgs_get_trans_reqs(const struct pkgs *p, uint pid, int reqby, struct sets *set) {
+	uint i, n, scc;
+	const struct sets *dag;
+	struct array reached, stack;
+
+	dag = reqby ? &p->scc_required_by : &p->scc_required;
+	scc = array_get(&p->sccs, pid);
+	n = sets_get_size(&p->scc_pkgs);
+
+	array_init(&reached, 1);
+	array_set_size(&reached, n);
+	array_init(&stack, 0);
+
+	/* a package in a loop requires itself */
+	if (pkgs_get(p, pid)->status & PKG_INLOOP) {
+		array_set(&reached, scc, 1);
+		add_scc_pkgs(p, scc, set);
+	}
 
-	for (i = 0; i < sets_get_subsets(r, pid); i++) {
-		s = sets_get_subset_size(r, pid, i);
-		for (j = 0; j < s; j++) {
-			req = sets_get(r, pid, i, j);
-			if (sets_has(set, 0, req))
-				continue;
-			sets_add(set, 0, 0, req);
-			pkgs_get_trans_reqs(p, req, reqby, set);
-		}
+	array_set(&stack, 0, scc);
+	while ((i = array_get_size(&stack))) {
+		scc = array_get(&stack, i - 1);
+		array_set_size(&stack, i - 1);
+		SETS_FOR_EACH(dag, scc, 0, s,
+			if (!array_get(&reached, s)) {
+				array_set(&reached, s, 1);
+				array_append(&stack, s);
+				add_scc_pkgs(p, s, set);
+			}
+		);
 	}
+
+	/* sort the packages */
+	sets_finalize(set);
+
+	array_clean(&stack);
+	array_clean(&reached);
 }
 
 void pkgs_get_matching_deps(const struct pkgs *p, uint pid1, uint pid2, int reqby, struct sets *set) {
-	uint i, dep1, dep2, iter;
-	const struct sets *r;
+	const struct sets *r, *resolved;
 
 	r = reqby ? &p->provides : &p->requires;
+	resolved = reqby ? &p->prov_reqs : &p->req_provs;
 
-	for (i = 0; i < sets_get_subset_size(r, pid1, 0); i++) {
-		dep1 = sets_get(r, pid1, 0, i);
-		iter = 0;
-
-		if (reqby) {
-			while ((dep2 = pkgs_find_req(p, dep1, &iter)) != -1)
-				if (sets_subset_has(&p->requires, pid2, 0, dep2))
-					break;
-		} else {
-			while ((dep2 = pkgs_find_prov(p, dep1, &iter)) != -1)
-				if (sets_subset_has(&p->provides, pid2, 0, dep2))
-					break;
-		}
-
-		if (dep2 == -1)
-			continue;
-
-		sets_add(set, 0, 0, dep1);
-	}
+	SETS_FOR_EACH(r, pid1, 0, dep,
+		if (sets_subset_has(resolved, dep, RESOLVED_PKGS, pid2))
+			sets_add(set, 0, 0, dep);
+	);
 }
@@ -41,7 +41,12 @@ struct pkg {
 	uint repo;
 };
 
+/* subsets of resolved deps with packages and with matching deps */
+#define RESOLVED_PKGS	0
+#define RESOLVED_DEPS	1
+
 struct pkgs {
+	struct arena arena;
 	struct strings strings;
 	struct array pkgs;
 	struct deps deps;
@@ -52,16 +57,40 @@ struct pkgs {
 	//struct sets conflicts;
 	struct sets required;
 	struct sets required_by;
-	struct sets sccs;
+
+	/* strongly connected components numbered in topological order of required */
+	struct array sccs;
+	/* numbers of loops, components with more than one package */
+	struct array loops;
+	struct sets scc_pkgs;
+	struct sets scc_required;
+	struct sets scc_required_by;
+
+	/* resolved deps, see RESOLVED_PKGS and RESOLVED_DEPS */
+	struct sets req_provs;
+	struct sets prov_reqs;
+
+	/* counters of live (not deleted) packages kept for leaf and broken checks */
+	struct array live_reqby;	/* hard requirers */
+	struct array live_orreqs;	/* OR deps of live requirers with the package */
+	struct array needed;		/* OR deps where the package is the only live one */
+	struct array dead_reqs;		/* deleted hard requires and OR deps */
+	struct array or_first;		/* index of the first OR dep of the package */
+	struct array or_live;		/* live packages in OR dep */
 
 	uint delete_pkgs;
 	uint break_pkgs;
 	uint pkgs_kbytes;
 	uint delete_pkgs_kbytes;
+
+	uint threads;
 };
 
 void pkgs_init(struct pkgs *p);
 void pkgs_clean(struct pkgs *p);
+void pkgs_reset(struct pkgs *p);
+void pkgs_reserve(struct pkgs *p, uint pkgs);
+void pkgs_set_threads(struct pkgs *p, uint threads);
 void pkgs_set(struct pkgs *pkgs, uint pid, uint repo, const char *name, int epoch,
 		const char *version, const char *release, const char *arch,
 		uint status, uint kbytes);
@@ -77,7 +106,7 @@ void pkgs_add_req_evr(struct pkgs *p, uint pid, const char *req, int flags,
 		uint epoch, const char *version, const char *release);
 void pkgs_add_prov_evr(struct pkgs *p, uint pid, const char *prov, int flags,
 		uint epoch, const char *version, const char *release);
-void pkgs_add_fileprov(struct pkgs *p, uint pid, const char *file);
+void pkgs_add_fileprov(struct pkgs *p, uint pid, uint file);
 uint pkgs_get_req_size(const struct pkgs *p, uint pid);
 uint pkgs_get_prov_size(const struct pkgs *p, uint pid);
 uint pkgs_get_req(const struct pkgs *p, uint pid, uint req);
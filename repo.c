@@ -19,11 +19,11 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <libgen.h>
 
 void repos_init(struct repos *repos) {
 	array_init(&repos->repos, sizeof (struct repo));
 	pkgs_init(&repos->pkgs);
+	memset(&repos->files_stats, 0, sizeof (repos->files_stats));
 }
 
 void repos_clean(struct repos *repos) {
@@ -63,19 +63,14 @@ int repos_read(struct repos *repos) {
 	struct repo *r;
 	struct pkgs *p = &repos->pkgs;
 	struct array firstpids;
-	struct strings files;
-	struct strings basenames;
-	char buf[1000];
+	struct paths files;
 	uint i, s;
 
-	if (pkgs_get_size(&repos->pkgs)) {
-		pkgs_clean(&repos->pkgs);
-		pkgs_init(&repos->pkgs);
-	}
+	if (pkgs_get_size(&repos->pkgs))
+		pkgs_reset(&repos->pkgs);
 
 	array_init(&firstpids, 0);
-	strings_init(&files);
-	strings_init(&basenames);
+	paths_init(&files);
 
 	for (i = 0; i < array_get_size(&repos->repos); i++) {
 		array_set(&firstpids, i, pkgs_get_size(&repos->pkgs));
@@ -85,35 +80,27 @@ int repos_read(struct repos *repos) {
 		r->repo_read(r, &repos->pkgs, array_get(&firstpids, i));
 	}
 
-	buf[sizeof (buf) - 1] = '\0';
-
-	/* find file requires */
+	/* find file requires, the values are their string ids */
 	for (s = strings_get_first(&p->strings); s != -1; s = strings_get_next(&p->strings, s)) {
 		const char *str;
 
 		str = strings_get(&p->strings, s);
-		if (str && str[0] == '/') {
-			char *base;
-
-			strncpy(buf, str, sizeof (buf) - 1);
-			base = basename(buf);
-			if (!strcmp(base, ".") || !strcmp(base, "/"))
-				continue;
-			strings_add(&files, str);
-			strings_add(&basenames, base);
-		}
+		if (str && str[0] == '/')
+			paths_add(&files, str, s);
 	}
+	paths_finalize(&files);
 
 	for (i = 0; i < array_get_size(&repos->repos); i++) {
 		r = repos_getw(repos, i);
 		if (r->repo_read_provs == NULL)
 			continue;
-		r->repo_read_provs(r, &repos->pkgs, array_get(&firstpids, i), &files, &basenames);
+		r->repo_read_provs(r, &repos->pkgs, array_get(&firstpids, i), &files);
 	}
 
+	repos->files_stats = files.stats;
+
 	array_clean(&firstpids);
-	strings_clean(&files);
-	strings_clean(&basenames);
+	paths_clean(&files);
 
 	pkgs_match_deps(&repos->pkgs);
 
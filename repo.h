@@ -25,7 +25,7 @@ struct repo {
 	void *data;
 	int (*repo_read)(const struct repo *repo, struct pkgs *p, uint firstpid);
 	int (*repo_read_provs)(const struct repo *repo, struct pkgs *p, uint firstpid,
-			const struct strings *files, const struct strings *basenames);
+			struct paths *files);
 	int (*repo_pkg_info)(const struct repo *repo, const struct pkgs *p, uint pid);
 	int (*repo_remove_pkgs)(const struct repo *repo, const struct pkgs *p, const char *options);
 	void (*repo_clean)(struct repo *repo);
@@ -34,6 +34,9 @@ struct repo {
 struct repos {
 	struct array repos;
 	struct pkgs pkgs;
+
+	/* lookups of basenames in the last read */
+	struct paths_stats files_stats;
 };
 
 void repos_init(struct repos *repos);
@@ -30,11 +30,32 @@
 #define FLAG_LIB_IN_USR 4
 #define FLAG_LIB64_IN_USR 8
 
+/* lookup of a file in the rpmdb index costs about as much as reading file
+   lists of this many packages */
+#define FILE_INDEX_COST 4
+
+/* provides and file lists saved in rpm_read() until all requires are known */
+struct rpmstaging {
+	struct strings strings;
+	struct array prov_first;
+	struct array prov_names;
+	struct array prov_flags;
+	struct array prov_evrs;
+	struct array file_first;
+	struct array file_dirs;
+	struct array file_bases;
+
+	/* pids of header instances if file requires are looked up in the index */
+	struct array pids;
+};
+
 struct rpmrepodata {
 	const char *root;
 	poptContext context;
 	rpmts ts;
 	int flags;
+	int fileindex;
+	struct rpmstaging staging;
 };
 
 static const char *get_cpath(const struct rpmrepodata *data, const char *path) {
@@ -47,17 +68,157 @@ static const char *get_cpath(const struct rpmrepodata *data, const char *path) {
 	return path;
 }
 
+/* write the path with /usr prefix if the canonical path is in a moved directory */
+static int get_usrpath(const struct rpmrepodata *data, const char *path, char *buf, size_t size) {
+	int r;
+
+	if ((data->flags & FLAG_BIN_IN_USR && !strncmp(path, "/bin/", 5)) ||
+		(data->flags & FLAG_SBIN_IN_USR && !strncmp(path, "/sbin/", 6)) ||
+		(data->flags & FLAG_LIB_IN_USR && !strncmp(path, "/lib/", 5)) ||
+		(data->flags & FLAG_LIB64_IN_USR && !strncmp(path, "/lib64/", 7))) {
+		r = snprintf(buf, size, "/usr%s", path);
+		return r > 0 && r < size;
+	}
+
+	return 0;
+}
+
+static void staging_init(struct rpmstaging *st) {
+	strings_init(&st->strings);
+	array_init(&st->prov_first, 0);
+	array_init(&st->prov_names, 0);
+	array_init(&st->prov_flags, 0);
+	array_init(&st->prov_evrs, 0);
+	array_init(&st->file_first, 0);
+	array_init(&st->file_dirs, 0);
+	array_init(&st->file_bases, 0);
+	array_init(&st->pids, 0);
+}
+
+static void staging_clean(struct rpmstaging *st) {
+	strings_clean(&st->strings);
+	array_clean(&st->prov_first);
+	array_clean(&st->prov_names);
+	array_clean(&st->prov_flags);
+	array_clean(&st->prov_evrs);
+	array_clean(&st->file_first);
+	array_clean(&st->file_dirs);
+	array_clean(&st->file_bases);
+	array_clean(&st->pids);
+}
+
+static void stage_provides(const struct rpmrepodata *rd, struct rpmstaging *st, Header header) {
+	rpmds provides;
+	const char *prov;
+	rpmsenseFlags provflags;
+
+	array_append(&st->prov_first, array_get_size(&st->prov_names));
+
+	provides = rpmdsNew(header, RPMTAG_PROVIDENAME, 0);
+	while (rpmdsNext(provides) != -1) {
+		prov = rpmdsN(provides);
+		if (prov[0] == '/')
+			prov = get_cpath(rd, prov);
+		provflags = rpmdsFlags(provides);
+		provflags &= RPMSENSE_LESS | RPMSENSE_GREATER |
+			RPMSENSE_EQUAL;
+		array_append(&st->prov_names, strings_add(&st->strings, prov));
+		array_append(&st->prov_flags, provflags);
+		array_append(&st->prov_evrs, strings_add(&st->strings, rpmdsEVR(provides)));
+	}
+	rpmdsFree(provides);
+}
+
+static void stage_files(struct rpmstaging *st, Header header, rpmtd bases, rpmtd dirs,
+		rpmtd dirindexes) {
+	uint i, n, *dirids, *fdirs, *fbases;
+	int r;
+
+	array_append(&st->file_first, array_get_size(&st->file_bases));
+
+	r = headerGet(header, RPMTAG_BASENAMES, bases, HEADERGET_DEFAULT);
+	if (r != 1)
+		return;
+
+	r = headerGet(header, RPMTAG_DIRNAMES, dirs, HEADERGET_DEFAULT);
+	assert(r == 1);
+	r = headerGet(header, RPMTAG_DIRINDEXES, dirindexes, HEADERGET_DEFAULT);
+	assert(r == 1);
+
+	/* add each directory only once, the ids of all files are appended at once */
+	dirids = malloc(rpmtdCount(dirs) * sizeof (uint));
+	for (i = 0; rpmtdNext(dirs) != -1; i++)
+		dirids[i] = strings_add(&st->strings, rpmtdGetString(dirs));
+
+	n = rpmtdCount(bases);
+	fdirs = malloc(n * sizeof (uint));
+	fbases = malloc(n * sizeof (uint));
+	for (i = 0; rpmtdNext(bases) != -1; i++) {
+		rpmtdSetIndex(dirindexes, rpmtdGetIndex(bases));
+		fdirs[i] = dirids[*rpmtdGetUint32(dirindexes)];
+		fbases[i] = strings_add(&st->strings, rpmtdGetString(bases));
+	}
+	array_append_n(&st->file_dirs, fdirs, i);
+	array_append_n(&st->file_bases, fbases, i);
+
+	free(fbases);
+	free(fdirs);
+	free(dirids);
+
+	rpmtdFreeData(bases);
+	rpmtdFreeData(dirs);
+	rpmtdFreeData(dirindexes);
+}
+
+/* count required files in the index of requires before reading the packages */
+static int use_file_index(rpmts ts, int pkgs) {
+	rpmdbIndexIterator ii;
+	const void *key;
+	size_t keylen;
+	uint files = 0;
+
+	ii = rpmdbIndexIteratorInit(rpmtsGetRdb(ts), RPMDBI_REQUIRENAME);
+	if (ii == NULL)
+		return 0;
+	while (rpmdbIndexIteratorNext(ii, &key, &keylen) == 0)
+		if (keylen > 0 && *(const char *)key == '/')
+			files++;
+	rpmdbIndexIteratorFree(ii);
+
+	return files * FILE_INDEX_COST < pkgs;
+}
+
+/*
+ * Each header is read only once. Provides and file lists are staged until
+ * rpm_read_provs() when all requires are known and the provides which are
+ * not required by any package can be dropped.
+ */
 static int rpm_read(const struct repo *repo, struct pkgs *p, uint firstpid) {
 	struct rpmrepodata *rd = repo->data;
+	struct rpmstaging *st = &rd->staging;
 	rpmdbMatchIterator iter;
 	Header header;
 	uint pid;
-	rpmtd td;
+	int count;
+	rpmtd td, bases, dirs, dirindexes;
 
 	td = rpmtdNew();
+	bases = rpmtdNew();
+	dirs = rpmtdNew();
+	dirindexes = rpmtdNew();
 	rd->ts = rpmtsCreate();
 	rpmtsSetRootDir(rd->ts, ((struct rpmrepodata *)repo->data)->root);
 	rpmtsSetVSFlags(rd->ts, _RPMVSF_NOSIGNATURES | _RPMVSF_NODIGESTS);
+	staging_init(st);
+
+	/* size the tables by the number of packages in the name index */
+	iter = rpmtsInitIterator(rd->ts, RPMTAG_NAME, NULL, 0);
+	count = rpmdbGetIteratorCount(iter);
+	iter = rpmdbFreeIterator(iter);
+	if (count > 0)
+		pkgs_reserve(p, firstpid + count);
+
+	rd->fileindex = use_file_index(rd->ts, count);
 
 	iter = rpmtsInitIterator(rd->ts, RPMDBI_PACKAGES, NULL, 0);
 	for (pid = firstpid; (header = rpmdbNextIterator(iter)) != NULL; pid++) {
@@ -92,91 +253,124 @@ static int rpm_read(const struct repo *repo, struct pkgs *p, uint firstpid) {
 			}
 		}
 		rpmdsFree(requires);
+
+		stage_provides(rd, st, header);
+		if (rd->fileindex)
+			array_set(&st->pids, rpmdbGetIteratorOffset(iter), pid + 1);
+		else
+			stage_files(st, header, bases, dirs, dirindexes);
 	}
+	array_append(&st->prov_first, array_get_size(&st->prov_names));
+	array_append(&st->file_first, array_get_size(&st->file_bases));
+
 	rpmtdFree(td);
+	rpmtdFree(bases);
+	rpmtdFree(dirs);
+	rpmtdFree(dirindexes);
 	iter = rpmdbFreeIterator(iter);
 
 	return 0;
 }
 
-static int rpm_read_provs(const struct repo *repo, struct pkgs *p, uint firstpid,
-		const struct strings *files, const struct strings *basenames) {
-	struct rpmrepodata *rd = repo->data;
-	rpmts ts = rd->ts;
+/* add the file to provides of all packages which have it in the file list */
+static void add_file_owners(rpmts ts, struct pkgs *p, const struct array *pids,
+		const char *path, uint file) {
 	rpmdbMatchIterator iter;
-	Header header;
-	char buf[1000];
-	const char *cpath;
-	uint pid;
-	rpmtd bases, dirs, dirindexes;
+	uint offset;
 
-	bases = rpmtdNew();
-	dirs = rpmtdNew();
-	dirindexes = rpmtdNew();
-	iter = rpmtsInitIterator(ts, RPMDBI_PACKAGES, NULL, 0);
+	iter = rpmtsInitIterator(ts, RPMDBI_BASENAMES, path, 0);
+	while (rpmdbNextIterator(iter) != NULL) {
+		offset = rpmdbGetIteratorOffset(iter);
+		if (offset < array_get_size(pids) && array_get(pids, offset))
+			pkgs_add_fileprov(p, array_get(pids, offset) - 1, file);
+	}
+	rpmdbFreeIterator(iter);
+}
 
-	for (pid = firstpid; (header = rpmdbNextIterator(iter)) != NULL; pid++) {
-		int r, dirsread = 0;
-		rpmds provides;
-		const char *prov, *provver;
-		rpmsenseFlags provflags;
-
-		provides = rpmdsNew(header, RPMTAG_PROVIDENAME, 0);
-		while (rpmdsNext(provides) != -1) {
-			prov = rpmdsN(provides);
-			if (prov[0] == '/')
-				prov = get_cpath(rd, prov);
-			provflags = rpmdsFlags(provides);
-			provver = rpmdsEVR(provides);
-			provflags &= RPMSENSE_LESS | RPMSENSE_GREATER |
-				RPMSENSE_EQUAL;
-			pkgs_add_prov(p, pid, prov, provflags, provver);
-		};
-		rpmdsFree(provides);
-
-		r = headerGet(header, RPMTAG_BASENAMES, bases, HEADERGET_DEFAULT);
-		if (r != 1)
+static void read_fileprovs_index(const struct rpmrepodata *rd, struct pkgs *p,
+		const struct paths *files) {
+	char buf[PATH_MAX];
+	const char *path;
+	uint i, file;
+
+	for (i = 0; i < paths_get_size(files); i++) {
+		file = paths_get_value(files, i);
+		path = strings_get(&p->strings, file);
+
+		add_file_owners(rd->ts, p, &rd->staging.pids, path, file);
+		if (get_usrpath(rd, path, buf, sizeof (buf)))
+			add_file_owners(rd->ts, p, &rd->staging.pids, buf, file);
+	}
+}
+
+/* map staged string of a directory or basename to its id in the paths */
+static uint get_path_id(const struct rpmrepodata *rd, struct paths *files,
+		uint *ids, uint string) {
+	const char *s;
+
+	if (ids[string] == -2) {
+		s = strings_get(&rd->staging.strings, string);
+		if (s[0] == '/')
+			ids[string] = paths_find_dir(files, get_cpath(rd, s));
+		else
+			ids[string] = paths_find_base(files, s);
+	}
+
+	return ids[string];
+}
+
+/*
+ * With only few file requires it's faster to look them up in the index of
+ * basenames than to read the file lists of all packages. The values of the
+ * paths are ids of the required strings.
+ */
+static int rpm_read_provs(const struct repo *repo, struct pkgs *p, uint firstpid,
+		struct paths *files) {
+	struct rpmrepodata *rd = repo->data;
+	struct rpmstaging *st = &rd->staging;
+	uint i, pid, n, base, dir, file, *ids;
+
+	n = strings_get_size(&st->strings);
+	ids = malloc(n * sizeof (uint));
+	for (i = 0; i < n; i++)
+		ids[i] = -2;
+
+	n = array_get_size(&st->prov_first) - 1;
+	for (pid = firstpid; pid < firstpid + n; pid++) {
+		for (i = array_get(&st->prov_first, pid - firstpid);
+				i < array_get(&st->prov_first, pid - firstpid + 1); i++)
+			pkgs_add_prov(p, pid,
+					strings_get(&st->strings, array_get(&st->prov_names, i)),
+					array_get(&st->prov_flags, i),
+					strings_get(&st->strings, array_get(&st->prov_evrs, i)));
+
+		if (rd->fileindex)
 			continue;
 
-		while (rpmtdNext(bases) != -1) {
-			if (strings_get_id(basenames, rpmtdGetString(bases)) == -1)
+		for (i = array_get(&st->file_first, pid - firstpid);
+				i < array_get(&st->file_first, pid - firstpid + 1); i++) {
+			base = get_path_id(rd, files, ids, array_get(&st->file_bases, i));
+			if (base == -1)
+				continue;
+			dir = get_path_id(rd, files, ids, array_get(&st->file_dirs, i));
+			if (dir == -1)
 				continue;
-			if (!dirsread) {
-				r = headerGet(header, RPMTAG_DIRNAMES, dirs,
-						HEADERGET_DEFAULT);
-				assert(r == 1);
-
-				r = headerGet(header, RPMTAG_DIRINDEXES, dirindexes,
-						HEADERGET_DEFAULT);
-				assert(r == 1);
-				dirsread = 1;
-			}
-
-			rpmtdSetIndex(dirindexes, rpmtdGetIndex(bases));
-			rpmtdSetIndex(dirs, *rpmtdGetUint32(dirindexes));
 
-			snprintf(buf, sizeof (buf), "%s%s", rpmtdGetString(dirs),
-					rpmtdGetString(bases));
-			cpath = get_cpath(rd, buf);
-			if (strings_get_id(files, cpath) == -1)
+			file = paths_find(files, dir, base);
+			if (file == -1)
 				continue;
 
-			pkgs_add_fileprov(p, pid, cpath);
-		}
-		rpmtdFreeData(bases);
-		if (dirsread) {
-			rpmtdFreeData(dirs);
-			rpmtdFreeData(dirindexes);
+			pkgs_add_fileprov(p, pid, file);
 		}
 	}
 
-	rpmtdFree(bases);
-	rpmtdFree(dirs);
-	rpmtdFree(dirindexes);
+	if (rd->fileindex)
+		read_fileprovs_index(rd, p, files);
 
-	iter = rpmdbFreeIterator(iter);
+	free(ids);
+	staging_clean(st);
 
-	rd->ts = rpmtsFree(ts);
+	rd->ts = rpmtsFree(rd->ts);
 
 	return 0;
 }
@@ -590,8 +590,8 @@ static int compare_rows(const void *row1, const void *row2) {
 	r2 = (const struct row *)row2;
 
 	if ((r1->flags | r2->flags) & (FLAG_DEPREQ | FLAG_DEPPROV))
-		return strcmp(strings_get(pkgs->deps.strings, array_get(&pkgs->deps.names, r1->dep)),
-				strings_get(pkgs->deps.strings, array_get(&pkgs->deps.names, r2->dep)));
+		return strcmp(strings_get(pkgs->deps.strings, deps_get_name(&pkgs->deps, r1->dep)),
+				strings_get(pkgs->deps.strings, deps_get_name(&pkgs->deps, r2->dep)));
 
 	p1 = pkgs_get(pkgs, r1->pid);
 	p2 = pkgs_get(pkgs, r2->pid);
@@ -1328,12 +1328,36 @@ void list_pkgs(struct repos *r, const char *limit, int verbose) {
 	print_pkgs(stdout, &r->pkgs, limit, verbose, 0);
 }
 
+int check_evrcmp(struct repos *r) {
+	uint mismatches;
+
+	repos_read(r);
+	mismatches = deps_check_evrcmp(&r->pkgs.deps, stdout);
+	printf("%u mismatches\n", mismatches);
+
+	return mismatches ? 1 : 0;
+}
+
+void print_stats(FILE *f, const struct repos *r) {
+	const struct pkgs *p = &r->pkgs;
+	const struct vercache *c = p->deps.vercache;
+	const struct paths_stats *s = &r->files_stats;
+	uint misses = s->rejected + s->false_positives;
+
+	fprintf(f, "packages: %u\n", pkgs_get_size(p));
+	fprintf(f, "deps: %u\n", deps_get_size(&p->deps));
+	fprintf(f, "version comparisons: %u cached, %u computed\n", c->hits, c->misses);
+	fprintf(f, "file basenames: %u looked up, %u filtered out, %u false positives (%.2f%%)\n",
+			s->lookups, s->rejected, s->false_positives,
+			misses ? 100.0 * s->false_positives / misses : 0.0);
+}
+
 int main(int argc, char **argv) {
 	struct repos r;
-	int opt, list = 0, verbose = 0;
+	int opt, list = 0, verbose = 0, stats = 0, threads = 0, check = 0, ret = 0;
 	const char *limit = NULL, *rpmroot = "/";
 
-	while ((opt = getopt(argc, argv, "lvr:h")) != -1) {
+	while ((opt = getopt(argc, argv, "lvsCj:r:h")) != -1) {
 		switch (opt) {
 			case 'l':
 				list = 1;
@@ -1341,6 +1365,16 @@ int main(int argc, char **argv) {
 			case 'v':
 				verbose = 1;
 				break;
+			case 's':
+				stats = 1;
+				break;
+			case 'C':
+				/* hidden, check version comparison with rpmvercmp() */
+				check = 1;
+				break;
+			case 'j':
+				threads = atoi(optarg);
+				break;
 			case 'r':
 				rpmroot = optarg;
 				break;
@@ -1349,6 +1383,8 @@ int main(int argc, char **argv) {
 				printf("usage: rpmreaper [options] [limit]\n");
 				printf("  -l        list packages\n");
 				printf("  -v        verbose listing\n");
+				printf("  -s        print statistics on exit\n");
+				printf("  -j num    number of threads (default number of CPUs)\n");
 				printf("  -r root   specify root (default /)\n");
 				printf("  -h        print usage\n");
 				return 0;
@@ -1356,16 +1392,23 @@ int main(int argc, char **argv) {
 	}
 
 	repos_init(&r);
+	if (threads > 0)
+		pkgs_set_threads(&r.pkgs, threads);
 	rpm_fillrepo(repos_new(&r), rpmroot);
 
 	if (optind < argc)
 		limit = argv[optind];
 
-	if (list)
+	if (check)
+		ret = check_evrcmp(&r);
+	else if (list)
 		list_pkgs(&r, limit, verbose);
 	else
 		tui(&r, limit);
 
+	if (stats)
+		print_stats(stderr, &r);
+
 	repos_clean(&r);
-	return 0;
+	return ret;
 }